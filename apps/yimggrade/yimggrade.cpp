@@ -48,8 +48,15 @@ int main(int argc, const char* argv[]) {
   // parse command line
   auto cli = cli::make_cli("yimgproc", "Transform images");
   add_option(cli, "--exposure,-e", params.exposure, "Tonemap exposure");
+  add_option(cli, "--auto-exposure/--no-auto-exposure", params.auto_exposure,
+      "Add exposure computed from image statistics");
   add_option(cli, "--filmic/--no-filmic,-f", params.filmic,
       "Tonemap uses filmic curve");
+  add_option(cli, "--local-tonemap/--no-local-tonemap", params.local_tonemap,
+      "Local tone mapping");
+  add_option(cli, "--local-contrast", params.local_contrast,
+      "Local tone mapping range in stops");
+  add_option(cli, "--bloom,-b", params.bloom, "Bloom intensity");
   add_option(cli, "--saturation,-s", params.saturation, "Grade saturation");
   add_option(cli, "--contrast,-c", params.contrast, "Grade contrast");
   add_option(cli, "--tint-red,-tr", params.tint.x, "Grade red tint");
@@ -76,10 +83,10 @@ int main(int argc, const char* argv[]) {
   if (!load_image(filename, img, ioerror)) cli::print_fatal(ioerror);
 
   // corrections
-  img = grd::grade_image(img, params);
+  auto graded = grd::grade_imageb(img, params);
 
   // save
-  if (!save_image(output, float_to_byte(img), ioerror))
+  if (!save_image(output, graded, ioerror))
     cli::print_fatal(ioerror);
 
   // done
@@ -84,6 +84,9 @@ int main(int argc, const char* argv[]) {
     return 1;
   }
 
+  // recycle the grading buffers across edits
+  img::set_image_pool_capacity(4 * app->source.count() * sizeof(vec4f));
+
   // update display
   update_display(app);
 
@@ -105,9 +108,14 @@ int main(int argc, const char* argv[]) {
     if (gui::begin_header(win, "grade")) {
       auto& params = app->params;
       edited += draw_slider(win, "exposure", params.exposure, -5, 5);
+      edited += draw_checkbox(win, "auto exposure", params.auto_exposure);
       edited += draw_checkbox(win, "filmic", params.filmic);
       continue_line(win);
       edited += draw_checkbox(win, "srgb", params.srgb);
+      edited += draw_checkbox(win, "local tonemap", params.local_tonemap);
+      edited += draw_slider(
+          win, "local contrast", params.local_contrast, 1, 12);
+      edited += draw_slider(win, "bloom", params.bloom, 0, 1);
       edited += draw_coloredit(win, "tint", params.tint);
       edited += draw_slider(win, "contrast", params.contrast, 0, 1);
       edited += draw_slider(win, "saturation", params.saturation, 0, 1);
@@ -30,12 +30,29 @@
 // INCLUDES
 // -----------------------------------------------------------------------------
 
+// 64-bit file offsets for streamed writes of large images
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include "yocto_image.h"
 
+#include <array>
 #include <atomic>
+#include <cstring>
 #include <future>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "ext/stb_image.h"
 #include "ext/stb_image_resize.h"
@@ -55,6 +72,8 @@ using math::clamp;
 using math::cos;
 using math::exp;
 using math::exp2;
+using math::flt_max;
+using math::flt_min;
 using math::fmod;
 using math::lerp;
 using math::log;
@@ -65,6 +84,7 @@ using math::pow;
 using math::sin;
 using math::sqrt;
 using math::tan;
+using math::zero2f;
 
 }  // namespace yocto::image
 
@@ -429,6 +449,76 @@ vec3f convert_color(const vec3f& col, color_space from, color_space to) {
 
 }  // namespace yocto::image
 
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION FOR IMAGE BUFFERS
+// -----------------------------------------------------------------------------
+namespace yocto::image {
+
+// Pool of freed image buffers indexed by size.
+struct image_pool {
+  std::mutex                              mutex    = {};
+  std::atomic<size_t>                     capacity = 0;
+  size_t                                  used     = 0;
+  std::unordered_multimap<size_t, void*> buffers  = {};
+};
+
+// The pool is never destroyed, so images in static storage can be safely
+// released at exit.
+static image_pool* get_image_pool() {
+  static auto pool = new image_pool{};
+  return pool;
+}
+
+// Enables recycling of image buffers.
+void set_image_pool_capacity(size_t capacity) {
+  auto pool      = get_image_pool();
+  auto lock      = std::lock_guard{pool->mutex};
+  pool->capacity = capacity;
+  for (auto it = pool->buffers.begin(); it != pool->buffers.end();) {
+    if (pool->used <= capacity) break;
+    pool->used -= it->first;
+    ::operator delete(it->second, std::align_val_t{64});
+    it = pool->buffers.erase(it);
+  }
+}
+
+namespace impl {
+
+// Allocates an aligned buffer, reusing a pooled one if available.
+void* allocate_image_buffer(size_t size) {
+  auto pool = get_image_pool();
+  if (pool->capacity) {
+    auto lock = std::lock_guard{pool->mutex};
+    auto it   = pool->buffers.find(size);
+    if (it != pool->buffers.end()) {
+      auto buffer = it->second;
+      pool->buffers.erase(it);
+      pool->used -= size;
+      return buffer;
+    }
+  }
+  return ::operator new(size, std::align_val_t{64});
+}
+
+// Frees a buffer, returning it to the pool if there is room.
+void free_image_buffer(void* buffer, size_t size) {
+  if (!buffer) return;
+  auto pool = get_image_pool();
+  if (pool->capacity) {
+    auto lock = std::lock_guard{pool->mutex};
+    if (pool->used + size <= pool->capacity) {
+      pool->buffers.emplace(size, buffer);
+      pool->used += size;
+      return;
+    }
+  }
+  ::operator delete(buffer, std::align_val_t{64});
+}
+
+}  // namespace impl
+
+}  // namespace yocto::image
+
 // -----------------------------------------------------------------------------
 // IMAGE SAMPLING
 // -----------------------------------------------------------------------------
@@ -524,34 +614,31 @@ vec3f eval_image(const image<vec3b>& img, const vec2f& uv, bool as_linear,
 // -----------------------------------------------------------------------------
 namespace yocto::image {
 
+// Copy `region` into `img` at `offset`, clipping to the image bounds.
 template <typename T>
 inline void set_region(
     image<T>& img, const image<T>& region, const vec2i& offset) {
-  for (auto j = 0; j < region.size().y; j++) {
-    for (auto i = 0; i < region.size().x; i++) {
-      if (!img.contains({i, j})) continue;
-      img[vec2i{i, j} + offset] = region[{i, j}];
-    }
-  }
-}
-
-template <typename T>
-inline void get_region(image<T>& clipped, const image<T>& img,
-    const vec2i& offset, const vec2i& size) {
-  clipped.resize(size);
-  for (auto j = 0; j < size.y; j++) {
-    for (auto i = 0; i < size.x; i++) {
-      clipped[{i, j}] = img[{i + offset.x, j + offset.y}];
-    }
-  }
+  auto start = max(offset, zero2i);
+  auto dst   = get_view(img, start, offset + region.size() - start);
+  auto src   = get_view(region, start - offset, dst.size());
+  copy_pixels(dst, src);
 }
 
 // Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the integer index.
+// parallel algorithms. `Func` takes the pixel index. Small images are
+// processed serially since spawning threads would dominate the runtime.
+// The cutoff counts pixels, so loops whose items are whole rows should use
+// the overload over indices below.
 template <typename Func>
 inline void parallel_for(const vec2i& size, Func&& func) {
-  auto             futures  = std::vector<std::future<void>>{};
-  auto             nthreads = std::thread::hardware_concurrency();
+  auto nthreads = std::thread::hardware_concurrency();
+  if (nthreads <= 1 || (size_t)size.x * (size_t)size.y < 16384) {
+    for (auto j = 0; j < size.y; j++) {
+      for (auto i = 0; i < size.x; i++) func({i, j});
+    }
+    return;
+  }
+  auto             futures = std::vector<std::future<void>>{};
   std::atomic<int> next_idx(0);
   for (auto thread_id = 0; thread_id < nthreads; thread_id++) {
     futures.emplace_back(
@@ -566,136 +653,394 @@ inline void parallel_for(const vec2i& size, Func&& func) {
   for (auto& f : futures) f.get();
 }
 
+// Simple parallel for over `num` coarse items, e.g. rows, tiles or files.
+// `Func` takes the integer index. Runs in parallel whenever there is more
+// than one item, since each item is assumed to be expensive.
+template <typename Func>
+inline void parallel_for(int num, Func&& func) {
+  auto nthreads = min((int)std::thread::hardware_concurrency(), num);
+  if (nthreads <= 1) {
+    for (auto idx = 0; idx < num; idx++) func(idx);
+    return;
+  }
+  auto             futures = std::vector<std::future<void>>{};
+  std::atomic<int> next_idx(0);
+  for (auto thread_id = 0; thread_id < nthreads; thread_id++) {
+    futures.emplace_back(
+        std::async(std::launch::async, [&func, &next_idx, num]() {
+          while (true) {
+            auto idx = next_idx.fetch_add(1);
+            if (idx >= num) break;
+            func(idx);
+          }
+        }));
+  }
+  for (auto& f : futures) f.get();
+}
+
+// Parallel for over image tiles. `Func` takes the pixel index and is called
+// for all pixels of a tile on the same thread, keeping memory accesses local.
+template <typename Func>
+inline void parallel_for_tiles(const vec2i& size, int tile, Func&& func) {
+  auto ntiles   = (size + tile - 1) / tile;
+  auto run_tile = [&func, ntiles, size, tile](int idx) {
+    auto start = vec2i{idx % ntiles.x, idx / ntiles.x} * tile;
+    auto end   = min(start + tile, size);
+    for (auto j = start.y; j < end.y; j++) {
+      for (auto i = start.x; i < end.x; i++) func({i, j});
+    }
+  };
+  if ((size_t)size.x * (size_t)size.y < 16384) {
+    for (auto idx = 0; idx < ntiles.x * ntiles.y; idx++) run_tile(idx);
+  } else {
+    parallel_for(ntiles.x * ntiles.y, run_tile);
+  }
+}
+
+// Apply `func` to every pixel of a view, writing to an image of the same size.
+template <typename R, typename T, typename Func>
+inline void map_pixels(
+    image<R>& result, const image_view<const T>& img, Func&& func) {
+  if (result.size() != img.size())
+    throw std::invalid_argument("image should be the same size");
+  parallel_for(
+      img.size(), [&](const vec2i& ij) { result[ij] = func(img[ij]); });
+}
+
+// Apply `func` to every pixel of a view, returning a packed image.
+template <typename R, typename T, typename Func>
+inline image<R> map_pixels(const image_view<const T>& img, Func&& func) {
+  auto result = image<R>{img.size(), uninit};
+  map_pixels(result, img, std::forward<Func>(func));
+  return result;
+}
+
+// Pointer to packed pixel data for `img`. Strided views are copied to `buffer`.
+template <typename T>
+inline const T* packed_pixels(
+    const image_view<const T>& img, image<T>& buffer) {
+  if (img.contiguous()) return img.data();
+  buffer = copy_image(img);
+  return buffer.data();
+}
+
 // Conversion from/to floats.
-image<vec4f> byte_to_float(const image<vec4b>& bt) {
-  auto fl = image<vec4f>{bt.size()};
-  for (auto i = 0ull; i < fl.count(); i++) fl[i] = byte_to_float(bt[i]);
-  return fl;
+image<vec4f> byte_to_float(const image_view<const vec4b>& bt) {
+  return map_pixels<vec4f>(bt, [](const vec4b& p) { return byte_to_float(p); });
 }
-image<vec4b> float_to_byte(const image<vec4f>& fl) {
-  auto bt = image<vec4b>{fl.size()};
-  for (auto i = 0ull; i < bt.count(); i++) bt[i] = float_to_byte(fl[i]);
-  return bt;
+image<vec4b> float_to_byte(const image_view<const vec4f>& fl) {
+  return map_pixels<vec4b>(fl, [](const vec4f& p) { return float_to_byte(p); });
 }
 
 // Conversion from/to floats.
-image<vec3f> byte_to_float(const image<vec3b>& bt) {
-  auto fl = image<vec3f>{bt.size()};
-  for (auto i = 0ull; i < fl.count(); i++) fl[i] = byte_to_float(bt[i]);
-  return fl;
+image<vec3f> byte_to_float(const image_view<const vec3b>& bt) {
+  return map_pixels<vec3f>(bt, [](const vec3b& p) { return byte_to_float(p); });
 }
-image<vec3b> float_to_byte(const image<vec3f>& fl) {
-  auto bt = image<vec3b>{fl.size()};
-  for (auto i = 0ull; i < bt.count(); i++) bt[i] = float_to_byte(fl[i]);
-  return bt;
+image<vec3b> float_to_byte(const image_view<const vec3f>& fl) {
+  return map_pixels<vec3b>(fl, [](const vec3f& p) { return float_to_byte(p); });
 }
 
 // Conversion from/to floats.
-image<float> byte_to_float(const image<byte>& bt) {
-  auto fl = image<float>{bt.size()};
-  for (auto i = 0ull; i < fl.count(); i++) fl[i] = math::byte_to_float(bt[i]);
-  return fl;
+image<float> byte_to_float(const image_view<const byte>& bt) {
+  return map_pixels<float>(
+      bt, [](byte p) { return math::byte_to_float(p); });
 }
-image<byte> float_to_byte(const image<float>& fl) {
-  auto bt = image<byte>{fl.size()};
-  for (auto i = 0ull; i < bt.count(); i++) bt[i] = math::float_to_byte(fl[i]);
-  return bt;
+image<byte> float_to_byte(const image_view<const float>& fl) {
+  return map_pixels<byte>(
+      fl, [](float p) { return math::float_to_byte(p); });
 }
 
 // Conversion between linear and gamma-encoded images.
-image<vec4f> srgb_to_rgb(const image<vec4f>& srgb) {
-  auto rgb = image<vec4f>{srgb.size()};
-  for (auto i = 0ull; i < rgb.count(); i++) rgb[i] = srgb_to_rgb(srgb[i]);
-  return rgb;
+image<vec4f> srgb_to_rgb(const image_view<const vec4f>& srgb) {
+  return map_pixels<vec4f>(
+      srgb, [](const vec4f& p) { return srgb_to_rgb(p); });
 }
-image<vec4f> rgb_to_srgb(const image<vec4f>& rgb) {
-  auto srgb = image<vec4f>{rgb.size()};
-  for (auto i = 0ull; i < srgb.count(); i++) srgb[i] = rgb_to_srgb(rgb[i]);
-  return srgb;
+image<vec4f> rgb_to_srgb(const image_view<const vec4f>& rgb) {
+  return map_pixels<vec4f>(rgb, [](const vec4f& p) { return rgb_to_srgb(p); });
 }
-image<vec4f> srgb_to_rgb(const image<vec4b>& srgb) {
-  auto rgb = image<vec4f>{srgb.size()};
-  for (auto i = 0ull; i < rgb.count(); i++)
-    rgb[i] = srgb_to_rgb(byte_to_float(srgb[i]));
-  return rgb;
+image<vec4f> srgb_to_rgb(const image_view<const vec4b>& srgb) {
+  return map_pixels<vec4f>(
+      srgb, [](const vec4b& p) { return srgb_to_rgb(byte_to_float(p)); });
 }
-image<vec4b> rgb_to_srgbb(const image<vec4f>& rgb) {
-  auto srgb = image<vec4b>{rgb.size()};
-  for (auto i = 0ull; i < srgb.count(); i++)
-    srgb[i] = float_to_byte(rgb_to_srgb(rgb[i]));
-  return srgb;
+image<vec4b> rgb_to_srgbb(const image_view<const vec4f>& rgb) {
+  return map_pixels<vec4b>(
+      rgb, [](const vec4f& p) { return float_to_byte(rgb_to_srgb(p)); });
 }
 
 // Conversion between linear and gamma-encoded images.
-image<vec3f> srgb_to_rgb(const image<vec3f>& srgb) {
-  auto rgb = image<vec3f>{srgb.size()};
-  for (auto i = 0ull; i < rgb.count(); i++) rgb[i] = srgb_to_rgb(srgb[i]);
-  return rgb;
+image<vec3f> srgb_to_rgb(const image_view<const vec3f>& srgb) {
+  return map_pixels<vec3f>(
+      srgb, [](const vec3f& p) { return srgb_to_rgb(p); });
 }
-image<vec3f> rgb_to_srgb(const image<vec3f>& rgb) {
-  auto srgb = image<vec3f>{rgb.size()};
-  for (auto i = 0ull; i < srgb.count(); i++) srgb[i] = rgb_to_srgb(rgb[i]);
-  return srgb;
+image<vec3f> rgb_to_srgb(const image_view<const vec3f>& rgb) {
+  return map_pixels<vec3f>(rgb, [](const vec3f& p) { return rgb_to_srgb(p); });
 }
-image<vec3f> srgb_to_rgb(const image<vec3b>& srgb) {
-  auto rgb = image<vec3f>{srgb.size()};
-  for (auto i = 0ull; i < rgb.count(); i++)
-    rgb[i] = srgb_to_rgb(byte_to_float(srgb[i]));
-  return rgb;
+image<vec3f> srgb_to_rgb(const image_view<const vec3b>& srgb) {
+  return map_pixels<vec3f>(
+      srgb, [](const vec3b& p) { return srgb_to_rgb(byte_to_float(p)); });
 }
-image<vec3b> rgb_to_srgbb(const image<vec3f>& rgb) {
-  auto srgb = image<vec3b>{rgb.size()};
-  for (auto i = 0ull; i < srgb.count(); i++)
-    srgb[i] = float_to_byte(rgb_to_srgb(rgb[i]));
-  return srgb;
+image<vec3b> rgb_to_srgbb(const image_view<const vec3f>& rgb) {
+  return map_pixels<vec3b>(
+      rgb, [](const vec3f& p) { return float_to_byte(rgb_to_srgb(p)); });
 }
 
 // Conversion between linear and gamma-encoded images.
-image<float> srgb_to_rgb(const image<float>& srgb) {
-  auto rgb = image<float>{srgb.size()};
-  for (auto i = 0ull; i < rgb.count(); i++) rgb[i] = math::srgb_to_rgb(srgb[i]);
-  return rgb;
+image<float> srgb_to_rgb(const image_view<const float>& srgb) {
+  return map_pixels<float>(srgb, [](float p) { return math::srgb_to_rgb(p); });
 }
-image<float> rgb_to_srgb(const image<float>& rgb) {
-  auto srgb = image<float>{rgb.size()};
-  for (auto i = 0ull; i < srgb.count(); i++)
-    srgb[i] = math::rgb_to_srgb(rgb[i]);
-  return srgb;
+image<float> rgb_to_srgb(const image_view<const float>& rgb) {
+  return map_pixels<float>(rgb, [](float p) { return math::rgb_to_srgb(p); });
 }
-image<float> srgb_to_rgb(const image<byte>& srgb) {
-  auto rgb = image<float>{srgb.size()};
-  for (auto i = 0ull; i < rgb.count(); i++)
-    rgb[i] = math::srgb_to_rgb(math::byte_to_float(srgb[i]));
-  return rgb;
+image<float> srgb_to_rgb(const image_view<const byte>& srgb) {
+  return map_pixels<float>(srgb,
+      [](byte p) { return math::srgb_to_rgb(math::byte_to_float(p)); });
 }
-image<byte> rgb_to_srgbb(const image<float>& rgb) {
-  auto srgb = image<byte>{rgb.size()};
-  for (auto i = 0ull; i < srgb.count(); i++)
-    srgb[i] = math::float_to_byte(math::rgb_to_srgb(rgb[i]));
-  return srgb;
+image<byte> rgb_to_srgbb(const image_view<const float>& rgb) {
+  return map_pixels<byte>(rgb,
+      [](float p) { return math::float_to_byte(math::rgb_to_srgb(p)); });
 }
 
 // Apply exposure and filmic tone mapping
-image<vec4f> tonemap_image(
-    const image<vec4f>& hdr, float exposure, bool filmic, bool srgb) {
-  auto ldr = image<vec4f>{hdr.size()};
-  for (auto i = 0ull; i < hdr.count(); i++)
-    ldr[i] = tonemap(hdr[i], exposure, filmic, srgb);
-  return ldr;
+image<vec4f> tonemap_image(const image_view<const vec4f>& hdr, float exposure,
+    bool filmic, bool srgb) {
+  return map_pixels<vec4f>(hdr,
+      [=](const vec4f& p) { return tonemap(p, exposure, filmic, srgb); });
+}
+image<vec4b> tonemap_imageb(const image_view<const vec4f>& hdr, float exposure,
+    bool filmic, bool srgb) {
+  return map_pixels<vec4b>(hdr, [=](const vec4f& p) {
+    return float_to_byte(tonemap(p, exposure, filmic, srgb));
+  });
+}
+
+void tonemap_image_mt(image<vec4f>& ldr, const image_view<const vec4f>& hdr,
+    float exposure, bool filmic, bool srgb) {
+  map_pixels(ldr, hdr,
+      [=](const vec4f& p) { return tonemap(p, exposure, filmic, srgb); });
 }
-image<vec4b> tonemap_imageb(
-    const image<vec4f>& hdr, float exposure, bool filmic, bool srgb) {
-  auto ldr = image<vec4b>{hdr.size()};
-  for (auto i = 0ull; i < hdr.count(); i++)
-    ldr[i] = float_to_byte(tonemap(hdr[i], exposure, filmic, srgb));
+void tonemap_image_mt(image<vec4b>& ldr, const image_view<const vec4f>& hdr,
+    float exposure, bool filmic, bool srgb) {
+  map_pixels(ldr, hdr, [=](const vec4f& p) {
+    return float_to_byte(tonemap(p, exposure, filmic, srgb));
+  });
+}
+
+// Bilateral grid storing sums of values and weights.
+struct bilateral_grid {
+  vec3i              size  = {0, 0, 0};
+  std::vector<vec2f> cells = {};
+
+  vec2f& operator[](const vec3i& ijk) {
+    return cells[((size_t)ijk.z * size.y + ijk.y) * size.x + ijk.x];
+  }
+};
+
+// Blur a bilateral grid with a [1 4 6 4 1] kernel along one axis.
+static void blur_bilateral_grid(bilateral_grid& grid, int axis) {
+  auto size = grid.size;
+  auto out  = grid.cells;
+  auto step = vec3i{0, 0, 0};
+  step[axis] = 1;
+  parallel_for(size.z, [&](int k) {
+    for (auto j = 0; j < size.y; j++) {
+      for (auto i = 0; i < size.x; i++) {
+        auto ijk = vec3i{i, j, k};
+        auto sum = zero2f;
+        for (auto [offset, weight] : {std::pair{-2, 1.0f}, std::pair{-1, 4.0f},
+                 std::pair{0, 6.0f}, std::pair{1, 4.0f}, std::pair{2, 1.0f}}) {
+          auto nijk = ijk + step * offset;
+          if (nijk[axis] < 0 || nijk[axis] >= size[axis]) continue;
+          sum += grid[nijk] * weight;
+        }
+        out[((size_t)k * size.y + j) * size.x + i] = sum / 16;
+      }
+    }
+  });
+  grid.cells = std::move(out);
+}
+
+// Compress the dynamic range of an HDR image with local tone mapping.
+image<vec4f> local_tonemap_image(
+    const image_view<const vec4f>& hdr, const local_tonemap_params& params) {
+  auto size = hdr.size();
+  if (size.x == 0 || size.y == 0) return image<vec4f>{size};
+
+  // log luminance and its range
+  auto loglum = image<float>{size, uninit};
+  auto ranges = std::vector<vec2f>(size.y);
+  parallel_for(size.y, [&](int j) {
+    auto row   = hdr.row(j);
+    auto range = vec2f{flt_max, -flt_max};
+    for (auto i = 0; i < size.x; i++) {
+      auto value     = std::log2(max(luminance(xyz(row[i])), 1e-6f));
+      loglum[{i, j}] = value;
+      range          = {min(range.x, value), max(range.y, value)};
+    }
+    ranges[j] = range;
+  });
+  auto range = vec2f{flt_max, -flt_max};
+  for (auto& row : ranges) range = {min(range.x, row.x), max(range.y, row.y)};
+
+  // grid cells are spatial_sigma x range_sigma in size, with a two cell
+  // border for the blur
+  auto cell_size = max(params.spatial_sigma * max(size), 1.0f);
+  auto cell_lum  = max(params.range_sigma, 0.01f);
+  auto grid      = bilateral_grid{};
+  grid.size      = {(int)(size.x / cell_size) + 5,
+      (int)(size.y / cell_size) + 5,
+      (int)((range.y - range.x) / cell_lum) + 5};
+  auto to_grid = [&](const vec2i& ij) {
+    return vec3f{ij.x / cell_size + 2, ij.y / cell_size + 2,
+        (loglum[ij] - range.x) / cell_lum + 2};
+  };
+
+  // splat into partial grids over chunks of rows
+  auto nchunks  = min(size.y, 16);
+  auto partials = std::vector<std::vector<vec2f>>(nchunks);
+  auto ncells   = (size_t)grid.size.x * grid.size.y * grid.size.z;
+  parallel_for(nchunks, [&](int chunk) {
+    auto& cells = partials[chunk];
+    cells.assign(ncells, zero2f);
+    auto start = (int)((size_t)size.y * chunk / nchunks);
+    auto end   = (int)((size_t)size.y * (chunk + 1) / nchunks);
+    for (auto j = start; j < end; j++) {
+      for (auto i = 0; i < size.x; i++) {
+        auto p   = to_grid({i, j});
+        auto ijk = vec3i{(int)(p.x + 0.5f), (int)(p.y + 0.5f),
+            (int)(p.z + 0.5f)};
+        cells[((size_t)ijk.z * grid.size.y + ijk.y) * grid.size.x + ijk.x] +=
+            vec2f{loglum[{i, j}], 1};
+      }
+    }
+  });
+  grid.cells.assign(ncells, zero2f);
+  for (auto& cells : partials) {
+    for (auto idx = (size_t)0; idx < ncells; idx++) {
+      grid.cells[idx] += cells[idx];
+    }
+  }
+  partials.clear();
+
+  // blur
+  for (auto axis = 0; axis < 3; axis++) blur_bilateral_grid(grid, axis);
+
+  // slice the base layer with trilinear interpolation
+  auto base = image<float>{size, uninit};
+  auto sums = std::vector<double>(size.y);
+  parallel_for(size.y, [&](int j) {
+    auto base_sum = 0.0;
+    for (auto i = 0; i < size.x; i++) {
+      auto p     = to_grid({i, j});
+      auto ijk   = vec3i{(int)p.x, (int)p.y, (int)p.z};
+      auto t     = p - vec3f{(float)ijk.x, (float)ijk.y, (float)ijk.z};
+      auto value = zero2f;
+      for (auto c = 0; c < 8; c++) {
+        auto corner = vec3i{c & 1, (c >> 1) & 1, (c >> 2) & 1};
+        auto weight = (corner.x ? t.x : 1 - t.x) * (corner.y ? t.y : 1 - t.y) *
+                      (corner.z ? t.z : 1 - t.z);
+        value += grid[min(ijk + corner, grid.size - 1)] * weight;
+      }
+      base[{i, j}] = value.y > 0 ? value.x / value.y : loglum[{i, j}];
+      base_sum += base[{i, j}];
+    }
+    sums[j] = base_sum;
+  });
+
+  // compress the base around its mean
+  auto mean = 0.0;
+  for (auto sum : sums) mean += sum;
+  mean /= (double)size.x * (double)size.y;
+  auto scale = min(params.contrast / max(range.y - range.x, 1e-6f), 1.0f);
+  auto ldr   = image<vec4f>{size, uninit};
+  parallel_for(size, [&](const vec2i& ij) {
+    auto detail = loglum[ij] - base[ij];
+    auto target = (float)mean + (base[ij] - (float)mean) * scale +
+                  detail * params.detail;
+    auto ratio  = std::exp2(target - loglum[ij]);
+    auto pixel  = hdr[ij];
+    ldr[ij]     = {pixel.x * ratio, pixel.y * ratio, pixel.z * ratio, pixel.w};
+  });
   return ldr;
 }
 
-void tonemap_image_mt(image<vec4f>& ldr, const image<vec4f>& hdr,
-    float exposure, bool filmic, bool srgb) {
-  parallel_for(hdr.size(),
-      [&](const vec2i& ij) { ldr[ij] = tonemap(hdr[ij], exposure, filmic, srgb); });
+// Apply local tone mapping followed by exposure and filmic tone mapping.
+image<vec4f> tonemap_image(const image_view<const vec4f>& hdr, float exposure,
+    const local_tonemap_params& local, bool filmic, bool srgb) {
+  auto compressed = local_tonemap_image(hdr, local);
+  tonemap_image_mt(compressed, compressed, exposure, filmic, srgb);
+  return compressed;
+}
+
+// Halve an image with a box filter, clamping odd sizes at the edge.
+static image<vec4f> downsample_image(const image<vec4f>& img) {
+  auto size  = img.size();
+  auto small = image<vec4f>{max((size + 1) / 2, vec2i{1, 1}), uninit};
+  parallel_for(small.size(), [&](const vec2i& ij) {
+    auto i0 = ij.x * 2, i1 = min(i0 + 1, size.x - 1);
+    auto j0 = ij.y * 2, j1 = min(j0 + 1, size.y - 1);
+    auto sum  = img[{i0, j0}] + img[{i1, j0}] + img[{i0, j1}] + img[{i1, j1}];
+    small[ij] = sum * 0.25f;
+  });
+  return small;
+}
+
+// Bilinearly upsample an image, aligning pixel centers and clamping edges.
+static image<vec4f> upsample_image(const image<vec4f>& img, const vec2i& size) {
+  auto large = image<vec4f>{size, uninit};
+  auto scale = (vec2f)img.size() / (vec2f)size;
+  auto last  = img.size() - 1;
+  parallel_for(size, [&](const vec2i& ij) {
+    auto st = max(((vec2f)ij + 0.5f) * scale - 0.5f, 0);
+    auto i = min((int)st.x, last.x), j = min((int)st.y, last.y);
+    auto ii = min(i + 1, last.x), jj = min(j + 1, last.y);
+    auto u = st.x - i, v = st.y - j;
+    large[ij] = img[{i, j}] * (1 - u) * (1 - v) + img[{ii, j}] * u * (1 - v) +
+                img[{i, jj}] * (1 - u) * v + img[{ii, jj}] * u * v;
+  });
+  return large;
+}
+
+// Add bloom to an HDR image.
+image<vec4f> bloom_image(
+    const image_view<const vec4f>& hdr, const bloom_params& params) {
+  if (hdr.empty() || params.levels <= 0) return copy_image(hdr);
+
+  // highlights above the threshold
+  auto highlights = map_pixels<vec4f>(hdr, [&](const vec4f& pixel) {
+    auto lum = luminance(xyz(pixel));
+    if (lum <= params.threshold) return vec4f{0, 0, 0, 0};
+    return vec4f{xyz(pixel) * ((lum - params.threshold) / lum), 0};
+  });
+
+  // gaussian pyramid, each level blurred before halving
+  auto pyramid = std::vector<image<vec4f>>{};
+  pyramid.push_back(downsample_image(highlights));
+  while ((int)pyramid.size() < params.levels &&
+         pyramid.back().size() != vec2i{1, 1}) {
+    pyramid.push_back(downsample_image(gaussian_blur_image(pyramid.back(), 1)));
+  }
+
+  // recombine from the coarsest level, weighting each level by radius
+  auto glow = gaussian_blur_image(pyramid.back(), 1);
+  auto norm = 1.0f;
+  for (auto level = (int)pyramid.size() - 2; level >= 0; level--) {
+    auto coarse = upsample_image(glow, pyramid[level].size());
+    glow        = gaussian_blur_image(pyramid[level], 1);
+    for (auto idx = 0; idx < (int)glow.count(); idx++) {
+      glow[idx] += coarse[idx] * params.radius;
+    }
+    norm = 1 + norm * params.radius;
+  }
+
+  // add the glow back to the image
+  auto bloom = upsample_image(glow, hdr.size());
+  auto scale = params.intensity / norm;
+  parallel_for(hdr.size(), [&](const vec2i& ij) {
+    bloom[ij] = hdr[ij] + bloom[ij] * scale;
+  });
+  return bloom;
 }
+
 vec3f colorgrade(
     const vec3f& rgb_, bool linear, const colorgrade_params& params) {
   auto rgb = rgb_;
@@ -735,30 +1080,322 @@ vec4f colorgrade(
 }
 
 // Apply exposure and filmic tone mapping
-image<vec4f> colorgrade_image(
-    const image<vec4f>& img, bool linear, const colorgrade_params& params) {
-  auto corrected = image<vec4f>{img.size()};
-  for (auto i = 0ull; i < img.count(); i++)
-    corrected[i] = colorgrade(img[i], linear, params);
-  return corrected;
+image<vec4f> colorgrade_image(const image_view<const vec4f>& img,
+    bool linear, const colorgrade_params& params) {
+  return map_pixels<vec4f>(img,
+      [&](const vec4f& p) { return colorgrade(p, linear, params); });
 }
 
-// Apply exposure and filmic tone mapping
-void colorgrade_image_mt(image<vec4f>& corrected, const image<vec4f>& img,
+image<vec4b> colorgrade_imageb(const image_view<const vec4f>& img,
     bool linear, const colorgrade_params& params) {
-  parallel_for(img.size(), [&](const vec2i& ij) {
-    corrected[ij] = colorgrade(img[ij], linear, params);
+  return map_pixels<vec4b>(img, [&](const vec4f& p) {
+    return float_to_byte(colorgrade(p, linear, params));
+  });
+}
+
+// Apply exposure and filmic tone mapping
+void colorgrade_image_mt(image<vec4f>& corrected,
+    const image_view<const vec4f>& img, bool linear,
+    const colorgrade_params& params) {
+  map_pixels(corrected, img,
+      [&](const vec4f& p) { return colorgrade(p, linear, params); });
+}
+void colorgrade_image_mt(image<vec4b>& corrected,
+    const image_view<const vec4f>& img, bool linear,
+    const colorgrade_params& params) {
+  map_pixels(corrected, img, [&](const vec4f& p) {
+    return float_to_byte(colorgrade(p, linear, params));
   });
 }
 
 // compute white balance
-vec3f compute_white_balance(const image<vec4f>& img) {
-  auto rgb = zero3f;
-  for (auto& p : img) rgb += xyz(p);
+vec3f compute_white_balance(const image_view<const vec4f>& img) {
+  auto rgb = xyz(compute_image_stats(img, 1).mean);
   if (rgb == zero3f) return zero3f;
   return rgb / max(rgb);
 }
 
+// Compute image statistics. Rows are split in chunks that accumulate
+// partial statistics in parallel, merged at the end.
+image_stats compute_image_stats(const image_view<const vec4f>& img, int bins,
+    float max_value, float min_log2, float max_log2) {
+  if (bins <= 0) throw std::invalid_argument("bad number of bins");
+  struct partial_stats {
+    vec4f               min = vec4f{flt_max}, max = vec4f{-flt_max};
+    float               min_luminance = flt_max, max_luminance = -flt_max;
+    double              sum[4] = {0, 0, 0, 0}, log_sum = 0;
+    std::vector<size_t> histograms[4];
+  };
+  auto delta    = 1e-4f;
+  auto size     = img.size();
+  auto nchunks  = min(size.y, 64);
+  auto partials = std::vector<partial_stats>(max(nchunks, 0));
+  auto to_bin   = [bins](float value, float min_value, float max_value) {
+    auto bin = (int)((value - min_value) / (max_value - min_value) * bins);
+    return clamp(bin, 0, bins - 1);
+  };
+  parallel_for(nchunks, [&](int chunk) {
+    auto& partial = partials[chunk];
+    for (auto& histogram : partial.histograms) histogram.assign(bins, 0);
+    auto start = (int)((size_t)size.y * chunk / nchunks);
+    auto end   = (int)((size_t)size.y * (chunk + 1) / nchunks);
+    for (auto j = start; j < end; j++) {
+      auto row = img.row(j);
+      for (auto i = 0; i < size.x; i++) {
+        auto& pixel   = row[i];
+        auto  lum     = luminance(xyz(pixel));
+        partial.min   = min(partial.min, pixel);
+        partial.max   = max(partial.max, pixel);
+        partial.min_luminance = min(partial.min_luminance, lum);
+        partial.max_luminance = max(partial.max_luminance, lum);
+        for (auto c = 0; c < 4; c++) partial.sum[c] += pixel[c];
+        partial.log_sum += std::log(delta + max(lum, 0.0f));
+        for (auto c = 0; c < 3; c++) {
+          partial.histograms[c][to_bin(pixel[c], 0, max_value)] += 1;
+        }
+        auto log_lum = std::log2(max(lum, flt_min));
+        partial.histograms[3][to_bin(log_lum, min_log2, max_log2)] += 1;
+      }
+    }
+  });
+
+  // merge partial statistics
+  auto stats      = image_stats{};
+  stats.max_value = max_value;
+  stats.min_log2  = min_log2;
+  stats.max_log2  = max_log2;
+  for (auto& histogram : stats.channel_histograms) histogram.assign(bins, 0);
+  stats.luminance_histogram.assign(bins, 0);
+  if (partials.empty() || size.x == 0) return stats;
+  auto merged = partial_stats{};
+  for (auto& partial : partials) {
+    merged.min           = min(merged.min, partial.min);
+    merged.max           = max(merged.max, partial.max);
+    merged.min_luminance = min(merged.min_luminance, partial.min_luminance);
+    merged.max_luminance = max(merged.max_luminance, partial.max_luminance);
+    for (auto c = 0; c < 4; c++) merged.sum[c] += partial.sum[c];
+    merged.log_sum += partial.log_sum;
+    for (auto b = 0; b < bins; b++) {
+      for (auto c = 0; c < 3; c++) {
+        stats.channel_histograms[c][b] += partial.histograms[c][b];
+      }
+      stats.luminance_histogram[b] += partial.histograms[3][b];
+    }
+  }
+  auto count          = (double)size.x * (double)size.y;
+  stats.min           = merged.min;
+  stats.max           = merged.max;
+  stats.mean          = {(float)(merged.sum[0] / count),
+      (float)(merged.sum[1] / count), (float)(merged.sum[2] / count),
+      (float)(merged.sum[3] / count)};
+  stats.min_luminance = merged.min_luminance;
+  stats.max_luminance = merged.max_luminance;
+  stats.log_average   = (float)std::exp(merged.log_sum / count);
+  return stats;
+}
+
+// Fraction of the histogram range below which `percentile` of the samples
+// fall, interpolating within bins.
+static float histogram_percentile(
+    const std::vector<size_t>& histogram, float percentile) {
+  auto total = (size_t)0;
+  for (auto count : histogram) total += count;
+  if (total == 0) return 0;
+  auto target = clamp(percentile, 0.0f, 1.0f) * (double)total;
+  auto sum    = 0.0;
+  for (auto b = 0; b < (int)histogram.size(); b++) {
+    if (histogram[b] && sum + histogram[b] >= target) {
+      auto t = (float)((target - sum) / histogram[b]);
+      return (b + t) / histogram.size();
+    }
+    sum += histogram[b];
+  }
+  return 1;
+}
+
+// Percentiles from histograms.
+float get_percentile(const image_stats& stats, int channel, float percentile) {
+  return histogram_percentile(
+             stats.channel_histograms.at(channel), percentile) *
+         stats.max_value;
+}
+float get_luminance_percentile(const image_stats& stats, float percentile) {
+  auto t = histogram_percentile(stats.luminance_histogram, percentile);
+  return std::exp2(stats.min_log2 + t * (stats.max_log2 - stats.min_log2));
+}
+
+// Exposure that maps the average log luminance between percentiles to key.
+float compute_auto_exposure(
+    const image_stats& stats, float key, float low, float high) {
+  auto& histogram = stats.luminance_histogram;
+  auto  total     = (size_t)0;
+  for (auto count : histogram) total += count;
+  if (total == 0) return 0;
+  auto low_count = low * (double)total, high_count = high * (double)total;
+  auto sum = 0.0, weight = 0.0, before = 0.0;
+  for (auto b = 0; b < (int)histogram.size(); b++) {
+    // portion of the bin between the two percentiles
+    auto count = std::min(histogram[b] + before, high_count) -
+                 std::max(before, low_count);
+    before += histogram[b];
+    if (count <= 0) continue;
+    auto log_lum = stats.min_log2 + (b + 0.5f) / histogram.size() *
+                                        (stats.max_log2 - stats.min_log2);
+    sum += log_lum * count;
+    weight += count;
+  }
+  if (weight == 0) return 0;
+  return std::log2(key) - (float)(sum / weight);
+}
+
+// Transpose an image in tiles, so that both reads and writes stay local.
+template <typename T>
+static image<T> transpose_image(const image<T>& img) {
+  auto size       = img.size();
+  auto transposed = image<T>{{size.y, size.x}, uninit};
+  auto tile       = 32;
+  parallel_for((size.y + tile - 1) / tile, [&](int tj) {
+    for (auto ti = 0; ti < size.x; ti += tile) {
+      for (auto j = tj * tile; j < min(tj * tile + tile, size.y); j++) {
+        for (auto i = ti; i < min(ti + tile, size.x); i++) {
+          transposed[{j, i}] = img[{i, j}];
+        }
+      }
+    }
+  });
+  return transposed;
+}
+
+// Apply a row filter horizontally and vertically. `filter(row, count,
+// buffer)` filters a row in place, using a scratch buffer.
+template <typename T, typename Filter>
+static image<T> blur_separable(
+    const image_view<const T>& img, Filter&& filter) {
+  auto filter_rows = [&](image<T>& img) {
+    auto size = img.size();
+    parallel_for(size.y, [&](int j) {
+      auto buffer = std::vector<T>{};
+      filter(&img[{0, j}], size.x, buffer);
+    });
+  };
+  auto blurred = copy_image(img);
+  if (blurred.empty()) return blurred;
+  filter_rows(blurred);
+  auto transposed = transpose_image(blurred);
+  filter_rows(transposed);
+  return transpose_image(transposed);
+}
+
+// Sliding window box filter of a row, clamping at the edges.
+template <typename T>
+static void box_filter_row(
+    T* row, int count, std::vector<T>& buffer, int radius) {
+  buffer.assign(row, row + count);
+  auto scale = 1.0f / (2 * radius + 1);
+  auto sum   = buffer[0] * (float)(radius + 1);
+  for (auto k = 1; k <= radius; k++) sum += buffer[min(k, count - 1)];
+  for (auto i = 0; i < count; i++) {
+    row[i] = sum * scale;
+    sum += buffer[min(i + radius + 1, count - 1)] - buffer[max(i - radius, 0)];
+  }
+}
+
+// Young and van Vliet recursive Gaussian filter of a row. The forward pass
+// starts from the steady state response to the first value and runs past
+// the end of the row on the last value, so that the backward pass sees the
+// clamped edges too.
+template <typename T>
+static void gaussian_filter_row(
+    T* row, int count, std::vector<T>& buffer, float sigma) {
+  auto q  = sigma >= 2.5f ? 0.98711f * sigma - 0.96330f
+                          : 3.97156f - 4.14554f * sqrt(1 - 0.26891f * sigma);
+  auto b0 = 1.57825f + 2.44413f * q + 1.4281f * q * q + 0.422205f * q * q * q;
+  auto b1 = (2.44413f * q + 2.85619f * q * q + 1.26661f * q * q * q) / b0;
+  auto b2 = -(1.4281f * q * q + 1.26661f * q * q * q) / b0;
+  auto b3 = (0.422205f * q * q * q) / b0;
+  auto B  = 1 - (b1 + b2 + b3);
+  auto padded = count + (int)ceil(4 * sigma);
+  buffer.resize(padded);
+  // forward pass
+  auto w1 = row[0], w2 = row[0], w3 = row[0];
+  for (auto i = 0; i < padded; i++) {
+    auto w    = row[min(i, count - 1)] * B + w1 * b1 + w2 * b2 + w3 * b3;
+    buffer[i] = w;
+    w3 = w2, w2 = w1, w1 = w;
+  }
+  // backward pass
+  auto y1 = buffer[padded - 1], y2 = y1, y3 = y1;
+  for (auto i = padded - 1; i >= 0; i--) {
+    auto y = buffer[i] * B + y1 * b1 + y2 * b2 + y3 * b3;
+    if (i < count) row[i] = y;
+    y3 = y2, y2 = y1, y1 = y;
+  }
+}
+
+// Radii of three box filters approximating a Gaussian, following Kovesi's
+// "Fast almost-Gaussian filtering".
+static std::array<int, 3> gaussian_box_radii(float sigma) {
+  auto ideal = sqrt(12 * sigma * sigma / 3 + 1);
+  auto lower = (int)ideal;
+  if (lower % 2 == 0) lower--;
+  auto upper  = lower + 2;
+  auto nlower = (int)round(
+      (12 * sigma * sigma - 3 * lower * lower - 12 * lower - 9) /
+      (-4.0f * lower - 4));
+  auto radii = std::array<int, 3>{};
+  for (auto i = 0; i < 3; i++) {
+    radii[i] = ((i < nlower ? lower : upper) - 1) / 2;
+  }
+  return radii;
+}
+
+// Blur images.
+template <typename T>
+static image<T> box_blur_image(
+    const image_view<const T>& img, int radius, int passes) {
+  if (radius <= 0 || passes <= 0) return copy_image(img);
+  return blur_separable(img, [&](T* row, int count, std::vector<T>& buffer) {
+    for (auto pass = 0; pass < passes; pass++) {
+      box_filter_row(row, count, buffer, radius);
+    }
+  });
+}
+template <typename T>
+static image<T> gaussian_blur_image(
+    const image_view<const T>& img, float sigma, bool recursive) {
+  if (sigma < 0.5f) return copy_image(img);
+  if (recursive) {
+    return blur_separable(img, [&](T* row, int count, std::vector<T>& buffer) {
+      gaussian_filter_row(row, count, buffer, sigma);
+    });
+  } else {
+    auto radii = gaussian_box_radii(sigma);
+    return blur_separable(img, [&](T* row, int count, std::vector<T>& buffer) {
+      for (auto radius : radii) {
+        if (radius > 0) box_filter_row(row, count, buffer, radius);
+      }
+    });
+  }
+}
+
+// Blur images.
+image<vec4f> box_blur_image(
+    const image_view<const vec4f>& img, int radius, int passes) {
+  return box_blur_image<vec4f>(img, radius, passes);
+}
+image<float> box_blur_image(
+    const image_view<const float>& img, int radius, int passes) {
+  return box_blur_image<float>(img, radius, passes);
+}
+image<vec4f> gaussian_blur_image(
+    const image_view<const vec4f>& img, float sigma, bool recursive) {
+  return gaussian_blur_image<vec4f>(img, sigma, recursive);
+}
+image<float> gaussian_blur_image(
+    const image_view<const float>& img, float sigma, bool recursive) {
+  return gaussian_blur_image<float>(img, sigma, recursive);
+}
+
 static vec2i resize_size(const vec2i& img_size, const vec2i& size_) {
   auto size = size_;
   if (size == zero2i) {
@@ -772,40 +1409,323 @@ static vec2i resize_size(const vec2i& img_size, const vec2i& size_) {
   return size;
 }
 
-image<vec4f> resize_image(const image<vec4f>& img, const vec2i& size_) {
+image<vec4f> resize_image(
+    const image_view<const vec4f>& img, const vec2i& size_) {
   auto size    = resize_size(img.size(), size_);
-  auto res_img = image<vec4f>{size};
+  auto res_img = image<vec4f>{size, uninit};
   stbir_resize_float_generic((float*)img.data(), img.size().x, img.size().y,
-      sizeof(vec4f) * img.size().x, (float*)res_img.data(), res_img.size().x,
+      sizeof(vec4f) * img.stride(), (float*)res_img.data(), res_img.size().x,
       res_img.size().y, sizeof(vec4f) * res_img.size().x, 4, 3, 0,
       STBIR_EDGE_CLAMP, STBIR_FILTER_DEFAULT, STBIR_COLORSPACE_LINEAR, nullptr);
   return res_img;
 }
-image<vec4b> resize_image(const image<vec4b>& img, const vec2i& size_) {
+image<vec4b> resize_image(
+    const image_view<const vec4b>& img, const vec2i& size_) {
   auto size    = resize_size(img.size(), size_);
-  auto res_img = image<vec4b>{size};
+  auto res_img = image<vec4b>{size, uninit};
   stbir_resize_uint8_generic((byte*)img.data(), img.size().x, img.size().y,
-      sizeof(vec4b) * img.size().x, (byte*)res_img.data(), res_img.size().x,
+      sizeof(vec4b) * img.stride(), (byte*)res_img.data(), res_img.size().x,
       res_img.size().y, sizeof(vec4b) * res_img.size().x, 4, 3, 0,
       STBIR_EDGE_CLAMP, STBIR_FILTER_DEFAULT, STBIR_COLORSPACE_LINEAR, nullptr);
   return res_img;
 }
 
-image<vec4f> image_difference(
-    const image<vec4f>& a, const image<vec4f>& b, bool display) {
+image<vec4f> image_difference(const image_view<const vec4f>& a,
+    const image_view<const vec4f>& b, bool display) {
   if (a.size() != b.size())
     throw std::invalid_argument("image haev different sizes");
-  auto diff = image<vec4f>{a.size()};
-  for (auto i = 0llu; i < diff.count(); i++) diff[i] = abs(a[i] - b[i]);
-  if (display) {
-    for (auto i = 0llu; i < diff.count(); i++) {
-      auto d  = max(diff[i]);
-      diff[i] = {d, d, d, 1};
+  auto diff = image<vec4f>{a.size(), uninit};
+  parallel_for(a.size(), [&](const vec2i& ij) {
+    auto d = abs(a[ij] - b[ij]);
+    if (display) {
+      auto m = max(d);
+      d      = {m, m, m, 1};
     }
-  }
+    diff[ij] = d;
+  });
   return diff;
 }
 
+// Compares an image to a reference.
+image_metrics compare_images(const image_view<const vec4f>& img,
+    const image_view<const vec4f>& reference, int tile_size,
+    float ssim_sigma) {
+  if (img.size() != reference.size())
+    throw std::invalid_argument("image should be the same size");
+  if (tile_size <= 0) throw std::invalid_argument("bad tile size");
+  if (!(ssim_sigma > 0)) throw std::invalid_argument("bad ssim sigma");
+  auto size    = img.size();
+  auto metrics = image_metrics{};
+  if (img.empty()) return metrics;
+
+  // squared and relative errors, summed per row
+  auto row_mse    = std::vector<double>(size.y, 0);
+  auto row_relmse = std::vector<double>(size.y, 0);
+  auto errors     = image<float>{size, uninit};
+  parallel_for(size.y, [&](int j) {
+    auto a = img.row(j), b = reference.row(j);
+    for (auto i = 0; i < size.x; i++) {
+      auto d = xyz(a[i]) - xyz(b[i]);
+      auto r = xyz(b[i]);
+      row_mse[j] += dot(d, d) / 3;
+      row_relmse[j] += sum(d * d / (r * r + 0.01f)) / 3;
+      errors[{i, j}] = max(abs(d));
+    }
+  });
+  auto npixels = (double)size.x * (double)size.y;
+  for (auto j = 0; j < size.y; j++) {
+    metrics.mse += row_mse[j] / npixels;
+    metrics.relmse += row_relmse[j] / npixels;
+  }
+  metrics.psnr = metrics.mse > 0 ? 10 * std::log10(1 / metrics.mse)
+                                 : std::numeric_limits<double>::infinity();
+
+  // per-tile max errors
+  auto ntiles = (size + tile_size - 1) / tile_size;
+  metrics.tile_errors = image<float>{ntiles, uninit};
+  parallel_for(ntiles.x * ntiles.y, [&](int idx) {
+    auto tile  = vec2i{idx % ntiles.x, idx / ntiles.x};
+    auto error = 0.0f;
+    auto start = tile * tile_size, end = min(start + tile_size, size);
+    for (auto j = start.y; j < end.y; j++) {
+      for (auto i = start.x; i < end.x; i++) error = max(error, errors[{i, j}]);
+    }
+    metrics.tile_errors[tile] = error;
+  });
+  for (auto idx = (size_t)0; idx < metrics.tile_errors.count(); idx++) {
+    metrics.max_error = max(metrics.max_error, metrics.tile_errors[idx]);
+  }
+
+  // ssim from blurred luminance moments
+  auto la = map_pixels<float>(
+      img, [](const vec4f& p) { return luminance(xyz(p)); });
+  auto lb = map_pixels<float>(
+      reference, [](const vec4f& p) { return luminance(xyz(p)); });
+  auto laa = image<float>{size, uninit}, lbb = image<float>{size, uninit},
+       lab = image<float>{size, uninit};
+  parallel_for(size, [&](const vec2i& ij) {
+    laa[ij] = la[ij] * la[ij];
+    lbb[ij] = lb[ij] * lb[ij];
+    lab[ij] = la[ij] * lb[ij];
+  });
+  auto mu_a = gaussian_blur_image(la, ssim_sigma);
+  auto mu_b = gaussian_blur_image(lb, ssim_sigma);
+  auto s_aa = gaussian_blur_image(laa, ssim_sigma);
+  auto s_bb = gaussian_blur_image(lbb, ssim_sigma);
+  auto s_ab = gaussian_blur_image(lab, ssim_sigma);
+  auto c1 = 0.01f * 0.01f, c2 = 0.03f * 0.03f;
+  metrics.ssim_map = image<float>{size, uninit};
+  auto row_ssim    = std::vector<double>(size.y, 0);
+  parallel_for(size.y, [&](int j) {
+    for (auto i = 0; i < size.x; i++) {
+      auto idx  = vec2i{i, j};
+      auto ma   = mu_a[idx], mb = mu_b[idx];
+      auto va   = s_aa[idx] - ma * ma, vb = s_bb[idx] - mb * mb;
+      auto cov  = s_ab[idx] - ma * mb;
+      auto ssim = ((2 * ma * mb + c1) * (2 * cov + c2)) /
+                  ((ma * ma + mb * mb + c1) * (va + vb + c2));
+      metrics.ssim_map[idx] = ssim;
+      row_ssim[j] += ssim;
+    }
+  });
+  for (auto& row : row_ssim) metrics.ssim += row / npixels;
+
+  return metrics;
+}
+
+// Maps errors to a false color image.
+image<vec4f> make_heatmap(
+    const image_view<const float>& errors, float max_error) {
+  return map_pixels<vec4f>(errors, [max_error](float error) {
+    auto t = max_error > 0 ? clamp(error / max_error, 0.0f, 1.0f) : 0.0f;
+    return vec4f{math::hsv_to_rgb({(1 - t) * 2 / 3.0f, 1, 1}), 1};
+  });
+}
+
+}  // namespace yocto::image
+
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION FOR BLOCK COMPRESSED IMAGES
+// -----------------------------------------------------------------------------
+namespace yocto::image {
+
+// Conversions between byte and integer colors.
+static vec3i to_vec3i(const vec3b& c) { return {c.x, c.y, c.z}; }
+static vec3f to_vec3f(const vec3b& c) {
+  return {(float)c.x, (float)c.y, (float)c.z};
+}
+static vec3b to_vec3b(const vec3i& c) {
+  return {(byte)c.x, (byte)c.y, (byte)c.z};
+}
+
+// Pack and unpack 565 colors, replicating high bits when expanding.
+static uint16_t pack_565(const vec3i& c) {
+  auto r = (c.x * 31 + 127) / 255, g = (c.y * 63 + 127) / 255,
+       b = (c.z * 31 + 127) / 255;
+  return (uint16_t)((r << 11) | (g << 5) | b);
+}
+static vec3i unpack_565(uint16_t c) {
+  auto r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+  return {(r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2)};
+}
+
+// Palettes of bc1 and bc4 blocks.
+static std::array<vec3i, 4> bc1_palette(uint64_t block) {
+  auto c0 = (uint16_t)(block & 0xffff), c1 = (uint16_t)((block >> 16) & 0xffff);
+  auto p0 = unpack_565(c0), p1 = unpack_565(c1);
+  if (c0 > c1) {
+    return {p0, p1, (2 * p0 + p1) / 3, (p0 + 2 * p1) / 3};
+  } else {
+    return {p0, p1, (p0 + p1) / 2, vec3i{0, 0, 0}};
+  }
+}
+static std::array<int, 8> bc4_palette(uint64_t block) {
+  auto r0 = (int)(block & 0xff), r1 = (int)((block >> 8) & 0xff);
+  if (r0 > r1) {
+    return {r0, r1, (6 * r0 + 1 * r1 + 3) / 7, (5 * r0 + 2 * r1 + 3) / 7,
+        (4 * r0 + 3 * r1 + 3) / 7, (3 * r0 + 4 * r1 + 3) / 7,
+        (2 * r0 + 5 * r1 + 3) / 7, (1 * r0 + 6 * r1 + 3) / 7};
+  } else {
+    return {r0, r1, (4 * r0 + 1 * r1 + 2) / 5, (3 * r0 + 2 * r1 + 2) / 5,
+        (2 * r0 + 3 * r1 + 2) / 5, (1 * r0 + 4 * r1 + 2) / 5, 0, 255};
+  }
+}
+
+// Encode a bc1 block. Endpoints are the extreme texels along the principal
+// axis of the block colors.
+static uint64_t encode_bc1(const std::array<vec3b, 16>& texels) {
+  auto mean = zero3f;
+  for (auto& texel : texels) mean += to_vec3f(texel) / 16;
+  auto cov = std::array<float, 6>{};
+  for (auto& texel : texels) {
+    auto d = to_vec3f(texel) - mean;
+    cov[0] += d.x * d.x, cov[1] += d.x * d.y, cov[2] += d.x * d.z;
+    cov[3] += d.y * d.y, cov[4] += d.y * d.z, cov[5] += d.z * d.z;
+  }
+  auto axis = vec3f{1, 1, 1};
+  for (auto iter = 0; iter < 8; iter++) {
+    axis = {cov[0] * axis.x + cov[1] * axis.y + cov[2] * axis.z,
+        cov[1] * axis.x + cov[3] * axis.y + cov[4] * axis.z,
+        cov[2] * axis.x + cov[4] * axis.y + cov[5] * axis.z};
+    auto len = max(abs(axis));
+    if (len == 0) break;
+    axis /= len;
+  }
+  auto min_texel = to_vec3i(texels[0]), max_texel = to_vec3i(texels[0]);
+  auto min_proj = dot(to_vec3f(texels[0]), axis), max_proj = min_proj;
+  for (auto& texel : texels) {
+    auto proj = dot(to_vec3f(texel), axis);
+    if (proj < min_proj) min_proj = proj, min_texel = to_vec3i(texel);
+    if (proj > max_proj) max_proj = proj, max_texel = to_vec3i(texel);
+  }
+  auto c0 = pack_565(max_texel), c1 = pack_565(min_texel);
+  if (c0 < c1) std::swap(c0, c1);
+  auto block = (uint64_t)c0 | ((uint64_t)c1 << 16);
+  if (c0 == c1) return block;
+  auto palette = bc1_palette(block);
+  for (auto k = 0; k < 16; k++) {
+    auto best = 0, best_dist = std::numeric_limits<int>::max();
+    for (auto idx = 0; idx < 4; idx++) {
+      auto d    = to_vec3i(texels[k]) - palette[idx];
+      auto dist = d.x * d.x + d.y * d.y + d.z * d.z;
+      if (dist < best_dist) best = idx, best_dist = dist;
+    }
+    block |= (uint64_t)best << (32 + 2 * k);
+  }
+  return block;
+}
+
+// Encode a bc4 block using the 8 value palette between min and max.
+static uint64_t encode_bc4(const std::array<byte, 16>& texels) {
+  auto r0 = texels[0], r1 = texels[0];
+  for (auto texel : texels) r0 = max(r0, texel), r1 = min(r1, texel);
+  auto block = (uint64_t)r0 | ((uint64_t)r1 << 8);
+  if (r0 == r1) return block;
+  auto palette = bc4_palette(block);
+  for (auto k = 0; k < 16; k++) {
+    auto best = 0, best_dist = 256;
+    for (auto idx = 0; idx < 8; idx++) {
+      auto dist = abs((int)texels[k] - palette[idx]);
+      if (dist < best_dist) best = idx, best_dist = dist;
+    }
+    block |= (uint64_t)best << (16 + 3 * k);
+  }
+  return block;
+}
+
+// Compress an image block by block, clamping blocks at the image edges.
+template <typename T, typename Encode>
+static block_image compress_blocks(
+    const image<T>& img, block_format format, Encode&& encode) {
+  auto compressed   = block_image{};
+  compressed.format = format;
+  compressed.extent = img.size();
+  if (img.empty()) return compressed;
+  auto nblocks = (img.size() + 3) / 4;
+  compressed.blocks.resize((size_t)nblocks.x * (size_t)nblocks.y);
+  parallel_for(nblocks.y, [&](int bj) {
+    for (auto bi = 0; bi < nblocks.x; bi++) {
+      auto texels = std::array<T, 16>{};
+      for (auto k = 0; k < 16; k++) {
+        auto ij   = vec2i{min(bi * 4 + k % 4, img.size().x - 1),
+            min(bj * 4 + k / 4, img.size().y - 1)};
+        texels[k] = img[ij];
+      }
+      compressed.blocks[(size_t)bj * nblocks.x + bi] = encode(texels);
+    }
+  });
+  return compressed;
+}
+
+// Compress color images with bc1 and scalar images with bc4.
+block_image compress_image(const image<vec3b>& img) {
+  return compress_blocks(img, block_format::bc1, encode_bc1);
+}
+block_image compress_image(const image<byte>& img) {
+  return compress_blocks(img, block_format::bc4, encode_bc4);
+}
+
+// Block containing a pixel and the pixel index within it.
+static std::pair<uint64_t, int> get_block(
+    const block_image& img, const vec2i& ij) {
+  auto nblocks = (img.extent.x + 3) / 4;
+  return {img.blocks[(size_t)(ij.y / 4) * nblocks + ij.x / 4],
+      (ij.y % 4) * 4 + ij.x % 4};
+}
+
+// Decode a single pixel.
+vec3b lookup_color(const block_image& img, const vec2i& ij) {
+  auto [block, k] = get_block(img, ij);
+  auto c0 = (uint16_t)(block & 0xffff), c1 = (uint16_t)((block >> 16) & 0xffff);
+  auto idx = (int)((block >> (32 + 2 * k)) & 3);
+  if (idx == 0) return to_vec3b(unpack_565(c0));
+  if (idx == 1) return to_vec3b(unpack_565(c1));
+  return to_vec3b(bc1_palette(block)[idx]);
+}
+byte lookup_scalar(const block_image& img, const vec2i& ij) {
+  auto [block, k] = get_block(img, ij);
+  auto idx = (int)((block >> (16 + 3 * k)) & 7);
+  return (byte)bc4_palette(block)[idx];
+}
+
+// Decompress a whole image.
+void decompress_image(image<vec3b>& img, const block_image& compressed) {
+  if (compressed.format != block_format::bc1)
+    throw std::invalid_argument("bc1 image expected");
+  img.resize(compressed.extent, uninit);
+  parallel_for(img.size(), [&](const vec2i& ij) {
+    img[ij] = lookup_color(compressed, ij);
+  });
+}
+void decompress_image(image<byte>& img, const block_image& compressed) {
+  if (compressed.format != block_format::bc4)
+    throw std::invalid_argument("bc4 image expected");
+  img.resize(compressed.extent, uninit);
+  parallel_for(img.size(), [&](const vec2i& ij) {
+    img[ij] = lookup_scalar(compressed, ij);
+  });
+}
+
 }  // namespace yocto::image
 
 // -----------------------------------------------------------------------------
@@ -815,42 +1735,110 @@ namespace yocto::image {
 
 // Comvert a bump map to a normal map.
 void bump_to_normal(image<vec4f>& norm, const image<vec4f>& img, float scale) {
-  norm.resize(img.size());
+  norm.resize(img.size(), uninit);
   auto dx = 1.0f / img.size().x, dy = 1.0f / img.size().y;
-  for (int j = 0; j < img.size().y; j++) {
-    for (int i = 0; i < img.size().x; i++) {
-      auto i1 = (i + 1) % img.size().x, j1 = (j + 1) % img.size().y;
-      auto p00 = img[{i, j}], p10 = img[{i1, j}], p01 = img[{i, j1}];
-      auto g00    = (p00.x + p00.y + p00.z) / 3;
-      auto g01    = (p01.x + p01.y + p01.z) / 3;
-      auto g10    = (p10.x + p10.y + p10.z) / 3;
-      auto normal = vec3f{
-          scale * (g00 - g10) / dx, scale * (g00 - g01) / dy, 1.0f};
-      normal.y = -normal.y;  // make green pointing up, even if y axis
-                             // points down
-      normal       = normalize(normal) * 0.5f + vec3f{0.5f, 0.5f, 0.5f};
-      norm[{i, j}] = {normal.x, normal.y, normal.z, 1};
-    }
-  }
+  parallel_for(img.size(), [&](const vec2i& ij) {
+    auto [i, j] = ij;
+    auto i1 = (i + 1) % img.size().x, j1 = (j + 1) % img.size().y;
+    auto p00 = img[{i, j}], p10 = img[{i1, j}], p01 = img[{i, j1}];
+    auto g00    = (p00.x + p00.y + p00.z) / 3;
+    auto g01    = (p01.x + p01.y + p01.z) / 3;
+    auto g10    = (p10.x + p10.y + p10.z) / 3;
+    auto normal = vec3f{
+        scale * (g00 - g10) / dx, scale * (g00 - g01) / dy, 1.0f};
+    normal.y = -normal.y;  // make green pointing up, even if y axis
+                           // points down
+    normal       = normalize(normal) * 0.5f + vec3f{0.5f, 0.5f, 0.5f};
+    norm[{i, j}] = {normal.x, normal.y, normal.z, 1};
+  });
 }
 image<vec4f> bump_to_normal(const image<vec4f>& img, float scale) {
-  auto norm = image<vec4f>{img.size()};
+  auto norm = image<vec4f>{img.size(), uninit};
   bump_to_normal(norm, img, scale);
   return norm;
 }
 
 template <typename Shader>
-void make_image(image<vec4f>& img, const vec2i& size, Shader&& shader) {
-  img.resize(size);
+static void make_image(image<vec4f>& img, const vec2i& size, Shader&& shader) {
+  img.resize(size, uninit);
   auto scale = 1.0f / max(size);
-  for (auto j = 0; j < img.size().y; j++) {
-    for (auto i = 0; i < img.size().x; i++) {
-      auto uv     = vec2f{i * scale, j * scale};
-      img[{i, j}] = shader(uv);
-    }
-  }
+  parallel_for_tiles(size, 64, [&](const vec2i& ij) {
+    img[ij] = shader(vec2f{ij.x * scale, ij.y * scale});
+  });
 };
 
+// Evaluate a shader over an image.
+void make_image(
+    image<vec4f>& img, const vec2i& size, const image_shader& shader) {
+  make_image<const image_shader&>(img, size, shader);
+}
+
+// Make a procedural image.
+procedural_image make_procedural_image(
+    const vec2i& size, const image_shader& shader, int tile_size) {
+  if (tile_size <= 0) throw std::invalid_argument("bad tile size");
+  auto ntiles   = (size + tile_size - 1) / tile_size;
+  auto count    = (size_t)ntiles.x * (size_t)ntiles.y;
+  auto img      = procedural_image{};
+  img.extent    = size;
+  img.tile_size = tile_size;
+  img.shader    = shader;
+  img.tiles.resize(count);
+  img.evaluated = std::make_unique<std::once_flag[]>(count);
+  return img;
+}
+
+// Evaluate a tile once.
+static const image<vec4f>& get_tile(procedural_image& img, const vec2i& tile) {
+  auto ntiles = (img.extent.x + img.tile_size - 1) / img.tile_size;
+  auto idx    = (size_t)tile.y * (size_t)ntiles + (size_t)tile.x;
+  std::call_once(img.evaluated[idx], [&img, &tile, idx]() {
+    auto start = tile * img.tile_size;
+    auto size  = min(start + img.tile_size, img.extent) - start;
+    auto scale  = 1.0f / max(img.extent);
+    auto pixels = image<vec4f>{size, uninit};
+    for (auto j = 0; j < size.y; j++) {
+      for (auto i = 0; i < size.x; i++) {
+        auto ij        = start + vec2i{i, j};
+        pixels[{i, j}] = img.shader(vec2f{ij.x * scale, ij.y * scale});
+      }
+    }
+    img.tiles[idx] = std::move(pixels);
+  });
+  return img.tiles[idx];
+}
+
+// Get a pixel, evaluating its tile if needed.
+vec4f get_pixel(procedural_image& img, const vec2i& ij) {
+  auto  tile   = ij / img.tile_size;
+  auto& pixels = get_tile(img, tile);
+  return pixels[ij - tile * img.tile_size];
+}
+
+// Get a region, evaluating the missing tiles in parallel.
+image<vec4f> get_region(
+    procedural_image& img, const vec2i& offset, const vec2i& size) {
+  auto start  = max(offset, zero2i);
+  auto end    = min(offset + size, img.extent);
+  auto region = image<vec4f>{max(end - start, zero2i), uninit};
+  if (region.empty()) return region;
+  auto first  = start / img.tile_size, last = (end - 1) / img.tile_size;
+  auto ntiles = last - first + 1;
+  parallel_for(ntiles.x * ntiles.y, [&](int idx) {
+    auto  tile   = first + vec2i{idx % ntiles.x, idx / ntiles.x};
+    auto& pixels = get_tile(img, tile);
+    auto  tstart = max(tile * img.tile_size, start);
+    auto  tend   = min(tile * img.tile_size + pixels.size(), end);
+    for (auto j = tstart.y; j < tend.y; j++) {
+      for (auto i = tstart.x; i < tend.x; i++) {
+        auto ij            = vec2i{i, j};
+        region[ij - start] = pixels[ij - tile * img.tile_size];
+      }
+    }
+  });
+  return region;
+}
+
 // Make an image
 void make_grid(image<vec4f>& img, const vec2i& size, float scale,
     const vec4f& color0, const vec4f& color1) {
@@ -963,44 +1951,58 @@ void make_blackbodyramp(
   });
 }
 
+// Make a noise image evaluating a row of pixels at a time with the batched
+// noise functions. Noise is mapped to [0,1] and used to blend colors.
+template <typename Noise>
+static void make_noise_image(image<vec4f>& img, const vec2i& size,
+    float scale, const vec4f& color0, const vec4f& color1, Noise&& noise) {
+  img.resize(size, uninit);
+  auto uvscale = 1.0f / max(size);
+  parallel_for(size.y, [&](int j) {
+    auto points = std::vector<vec3f>(size.x);
+    auto values = std::vector<float>(size.x);
+    for (auto i = 0; i < size.x; i++) {
+      points[i] = {
+          (i * uvscale) * (8 * scale), (j * uvscale) * (8 * scale), 0.5f};
+    }
+    noise(values.data(), points.data(), points.size());
+    for (auto i = 0; i < size.x; i++) {
+      auto v      = clamp(0.5f + 0.5f * values[i], 0.0f, 1.0f);
+      img[{i, j}] = lerp(color0, color1, v);
+    }
+  });
+}
+
 void make_noisemap(image<vec4f>& img, const vec2i& size, float scale,
     const vec4f& color0, const vec4f& color1) {
-  return make_image(img, size, [=](vec2f uv) {
-    uv *= 8 * scale;
-    auto v = math::perlin_noise({uv.x, uv.y, 0.5f});
-    v      = clamp(0.5f + 0.5f * v, 0.0f, 1.0f);
-    return lerp(color0, color1, v);
-  });
+  make_noise_image(img, size, scale, color0, color1,
+      [](float* values, const vec3f* points, size_t count) {
+        math::perlin_noise(values, points, count);
+      });
 }
 void make_fbmmap(image<vec4f>& img, const vec2i& size, float scale,
     const vec4f& noise, const vec4f& color0, const vec4f& color1) {
-  return make_image(img, size, [=](vec2f uv) {
-    uv *= 8 * scale;
-    auto v = math::perlin_fbm(
-        {uv.x, uv.y, 0.5f}, noise.x, noise.y, (int)noise.z);
-    v = clamp(0.5f + 0.5f * v, 0.0f, 1.0f);
-    return lerp(color0, color1, v);
-  });
+  make_noise_image(img, size, scale, color0, color1,
+      [&](float* values, const vec3f* points, size_t count) {
+        math::perlin_fbm(
+            values, points, count, noise.x, noise.y, (int)noise.z);
+      });
 }
 void make_turbulencemap(image<vec4f>& img, const vec2i& size, float scale,
     const vec4f& noise, const vec4f& color0, const vec4f& color1) {
-  return make_image(img, size, [=](vec2f uv) {
-    uv *= 8 * scale;
-    auto v = math::perlin_turbulence(
-        {uv.x, uv.y, 0.5f}, noise.x, noise.y, (int)noise.z);
-    v = clamp(0.5f + 0.5f * v, 0.0f, 1.0f);
-    return lerp(color0, color1, v);
-  });
+  make_noise_image(img, size, scale, color0, color1,
+      [&](float* values, const vec3f* points, size_t count) {
+        math::perlin_turbulence(
+            values, points, count, noise.x, noise.y, (int)noise.z);
+      });
 }
 void make_ridgemap(image<vec4f>& img, const vec2i& size, float scale,
     const vec4f& noise, const vec4f& color0, const vec4f& color1) {
-  return make_image(img, size, [=](vec2f uv) {
-    uv *= 8 * scale;
-    auto v = math::perlin_ridge(
-        {uv.x, uv.y, 0.5f}, noise.x, noise.y, (int)noise.z, noise.w);
-    v = clamp(0.5f + 0.5f * v, 0.0f, 1.0f);
-    return lerp(color0, color1, v);
-  });
+  make_noise_image(img, size, scale, color0, color1,
+      [&](float* values, const vec3f* points, size_t count) {
+        math::perlin_ridge(values, points, count, noise.x, noise.y,
+            (int)noise.z, noise.w);
+      });
 }
 
 // Add image border
@@ -1008,15 +2010,13 @@ image<vec4f> add_border(
     const image<vec4f>& source, float width, const vec4f& color) {
   auto img   = source;
   auto scale = 1.0f / max(img.size());
-  for (auto j = 0; j < img.size().y; j++) {
-    for (auto i = 0; i < img.size().x; i++) {
-      auto uv = vec2f{i * scale, j * scale};
-      if (uv.x < width || uv.y < width || uv.x > img.size().x * scale - width ||
-          uv.y > img.size().y * scale - width) {
-        img[{i, j}] = color;
-      }
+  parallel_for(img.size(), [&](const vec2i& ij) {
+    auto uv = vec2f{ij.x * scale, ij.y * scale};
+    if (uv.x < width || uv.y < width || uv.x > img.size().x * scale - width ||
+        uv.y > img.size().y * scale - width) {
+      img[ij] = color;
     }
-  }
+  });
   return img;
 };
 
@@ -1110,48 +2110,41 @@ void make_sunsky(image<vec4f>& img, const vec2i& size, float theta_sun,
     return (has_sun && gamma < sun_angular_radius) ? sun_le / 10000 : zero3f;
   };
 
-  // Make the sun sky image
-  img               = image<vec4f>{size};
-  auto sky_integral = 0.0f, sun_integral = 0.0f;
-  for (auto j = 0; j < img.size().y / 2; j++) {
-    auto theta = pif * ((j + 0.5f) / img.size().y);
-    theta      = clamp(theta, 0.0f, pif / 2 - math::flt_eps);
-    for (int i = 0; i < img.size().x; i++) {
-      auto phi = 2 * pif * (float(i + 0.5f) / img.size().x);
-      auto w = vec3f{cos(phi) * sin(theta), cos(theta), sin(phi) * sin(theta)};
-      auto gamma   = acos(clamp(dot(w, sun_direction), -1.0f, 1.0f));
-      auto sky_col = sky(theta, gamma, theta_sun);
-      auto sun_col = sun(theta, gamma);
-      sky_integral += mean(sky_col) * sin(theta);
-      sun_integral += mean(sun_col) * sin(theta);
-      auto col    = sky_col + sun_col;
-      img[{i, j}] = {col.x, col.y, col.z, 1};
-    }
-  }
+  // Make the sun sky image, with the ground light summed per row
+  img         = image<vec4f>{size, uninit};
+  auto ground = std::vector<vec3f>(img.size().y / 2, zero3f);
+  auto sky_size = vec2i{img.size().x, img.size().y / 2};
+  parallel_for_tiles(sky_size, 64, [&](const vec2i& ij) {
+    auto [i, j] = ij;
+    auto theta  = pif * ((j + 0.5f) / img.size().y);
+    theta       = clamp(theta, 0.0f, pif / 2 - math::flt_eps);
+    auto phi    = 2 * pif * (float(i + 0.5f) / img.size().x);
+    auto w = vec3f{cos(phi) * sin(theta), cos(theta), sin(phi) * sin(theta)};
+    auto gamma   = acos(clamp(dot(w, sun_direction), -1.0f, 1.0f));
+    auto sky_col = sky(theta, gamma, theta_sun);
+    auto sun_col = sun(theta, gamma);
+    auto col     = sky_col + sun_col;
+    img[{i, j}]  = {col.x, col.y, col.z, 1};
+  });
 
+  auto ground_col = zero3f;
   if (ground_albedo != zero3f) {
-    auto ground = zero3f;
-    for (auto j = 0; j < img.size().y / 2; j++) {
+    parallel_for(img.size().y / 2, [&](int j) {
       auto theta = pif * ((j + 0.5f) / img.size().y);
       for (int i = 0; i < img.size().x; i++) {
         auto pxl   = img[{i, j}];
         auto le    = vec3f{pxl.x, pxl.y, pxl.z};
         auto angle = sin(theta) * 4 * pif / (img.size().x * img.size().y);
-        ground += le * (ground_albedo / pif) * cos(theta) * angle;
-      }
-    }
-    for (auto j = img.size().y / 2; j < img.size().y; j++) {
-      for (int i = 0; i < img.size().x; i++) {
-        img[{i, j}] = {ground.x, ground.y, ground.z, 1};
+        ground[j] += le * (ground_albedo / pif) * cos(theta) * angle;
       }
-    }
-  } else {
-    for (auto j = img.size().y / 2; j < img.size().y; j++) {
-      for (int i = 0; i < img.size().x; i++) {
-        img[{i, j}] = {0, 0, 0, 1};
-      }
-    }
+    });
+    for (auto& row : ground) ground_col += row;
   }
+  parallel_for_tiles({img.size().x, img.size().y - img.size().y / 2}, 64,
+      [&](const vec2i& ij) {
+        img[{ij.x, ij.y + img.size().y / 2}] = {
+            ground_col.x, ground_col.y, ground_col.z, 1};
+      });
 }
 
 // Make an image of multiple lights.
@@ -1287,47 +2280,181 @@ image<vec4b> add_logo(const image<vec4b>& img, const std::string& type) {
 namespace yocto::image {
 
 // Lookup volume
-inline float lookup_volume(
-    const volume<float>& vol, const vec3i& ijk, bool as_linear) {
+float lookup_volume(const volume<float>& vol, const vec3i& ijk) {
   return vol[ijk];
 }
+float lookup_volume(const sparse_volume& vol, const vec3i& ijk) {
+  auto nbricks = get_bricks(vol);
+  auto brick   = ijk / volume_brick_size;
+  auto offset  = vol.bricks[((size_t)brick.z * nbricks.y + brick.y) *
+                               nbricks.x +
+                           brick.x];
+  if (offset < 0) return vol.background;
+  auto local = ijk - brick * volume_brick_size;
+  return vol.voxels[(size_t)offset +
+                    (local.z * volume_brick_size + local.y) *
+                        volume_brick_size +
+                    local.x];
+}
+
+// Computes the voxel, its next neighbor and the residual along one axis for
+// a coordinate in [-1,1], clamping or wrapping at the volume edges.
+static void eval_volume_coord(float x, int size, bool clamp_to_edge, int& i,
+    int& ii, float& u) {
+  auto s = 0.0f;
+  if (clamp_to_edge) {
+    s = clamp((x + 1.0f) * 0.5f, 0.0f, 1.0f) * size;
+  } else {
+    s = fmod((x + 1.0f) * 0.5f, 1.0f) * size;
+    if (s < 0) s += size;
+  }
+  i  = clamp((int)s, 0, size - 1);
+  ii = clamp_to_edge ? min(i + 1, size - 1) : (i + 1) % size;
+  u  = s - i;
+}
 
-// Evaluates a color image at a point `uv`.
-inline float eval_volume(const volume<float>& vol, const vec3f& uvw,
-    bool ldr_as_linear, bool no_interpolation, bool clamp_to_edge) {
+// Evaluates a volume at a point `uvw`.
+template <typename Volume>
+static float eval_volume_generic(const Volume& vol, const vec3f& uvw,
+    bool no_interpolation, bool clamp_to_edge) {
   if (vol.empty()) return 0;
 
-  // get coordinates normalized for tiling
-  auto s = clamp((uvw.x + 1.0f) * 0.5f, 0.0f, 1.0f) * vol.size().x;
-  auto t = clamp((uvw.y + 1.0f) * 0.5f, 0.0f, 1.0f) * vol.size().y;
-  auto r = clamp((uvw.z + 1.0f) * 0.5f, 0.0f, 1.0f) * vol.size().z;
-
-  // get image coordinates and residuals
-  auto i  = clamp((int)s, 0, vol.size().x - 1);
-  auto j  = clamp((int)t, 0, vol.size().y - 1);
-  auto k  = clamp((int)r, 0, vol.size().z - 1);
-  auto ii = (i + 1) % vol.size().x, jj = (j + 1) % vol.size().y,
-       kk = (k + 1) % vol.size().z;
-  auto u = s - i, v = t - j, w = r - k;
+  // get voxel coordinates and residuals
+  auto i = 0, j = 0, k = 0, ii = 0, jj = 0, kk = 0;
+  auto u = 0.0f, v = 0.0f, w = 0.0f;
+  eval_volume_coord(uvw.x, vol.size().x, clamp_to_edge, i, ii, u);
+  eval_volume_coord(uvw.y, vol.size().y, clamp_to_edge, j, jj, v);
+  eval_volume_coord(uvw.z, vol.size().z, clamp_to_edge, k, kk, w);
 
   // nearest-neighbor interpolation
   if (no_interpolation) {
-    i = u < 0.5 ? i : min(i + 1, vol.size().x - 1);
-    j = v < 0.5 ? j : min(j + 1, vol.size().y - 1);
-    k = w < 0.5 ? k : min(k + 1, vol.size().z - 1);
-    return lookup_volume(vol, {i, j, k}, ldr_as_linear);
+    return lookup_volume(
+        vol, {u < 0.5 ? i : ii, v < 0.5 ? j : jj, w < 0.5 ? k : kk});
   }
 
   // trilinear interpolation
-  return lookup_volume(vol, {i, j, k}, ldr_as_linear) * (1 - u) * (1 - v) *
-             (1 - w) +
-         lookup_volume(vol, {ii, j, k}, ldr_as_linear) * u * (1 - v) * (1 - w) +
-         lookup_volume(vol, {i, jj, k}, ldr_as_linear) * (1 - u) * v * (1 - w) +
-         lookup_volume(vol, {i, j, kk}, ldr_as_linear) * (1 - u) * (1 - v) * w +
-         lookup_volume(vol, {i, jj, kk}, ldr_as_linear) * (1 - u) * v * w +
-         lookup_volume(vol, {ii, j, kk}, ldr_as_linear) * u * (1 - v) * w +
-         lookup_volume(vol, {ii, jj, k}, ldr_as_linear) * u * v * (1 - w) +
-         lookup_volume(vol, {ii, jj, kk}, ldr_as_linear) * u * v * w;
+  return lookup_volume(vol, {i, j, k}) * (1 - u) * (1 - v) * (1 - w) +
+         lookup_volume(vol, {ii, j, k}) * u * (1 - v) * (1 - w) +
+         lookup_volume(vol, {i, jj, k}) * (1 - u) * v * (1 - w) +
+         lookup_volume(vol, {i, j, kk}) * (1 - u) * (1 - v) * w +
+         lookup_volume(vol, {i, jj, kk}) * (1 - u) * v * w +
+         lookup_volume(vol, {ii, j, kk}) * u * (1 - v) * w +
+         lookup_volume(vol, {ii, jj, k}) * u * v * (1 - w) +
+         lookup_volume(vol, {ii, jj, kk}) * u * v * w;
+}
+
+// Evaluates a volume at a point `uvw`.
+float eval_volume(const volume<float>& vol, const vec3f& uvw,
+    bool no_interpolation, bool clamp_to_edge) {
+  return eval_volume_generic(vol, uvw, no_interpolation, clamp_to_edge);
+}
+float eval_volume(const sparse_volume& vol, const vec3f& uvw,
+    bool no_interpolation, bool clamp_to_edge) {
+  if (vol.empty()) return 0;
+  // skip empty bricks when all the voxels of the lookup lie in one brick
+  auto ijk = zero3i, next = zero3i;
+  auto residual = zero3f;
+  eval_volume_coord(uvw.x, vol.size().x, clamp_to_edge, ijk.x, next.x,
+      residual.x);
+  eval_volume_coord(uvw.y, vol.size().y, clamp_to_edge, ijk.y, next.y,
+      residual.y);
+  eval_volume_coord(uvw.z, vol.size().z, clamp_to_edge, ijk.z, next.z,
+      residual.z);
+  auto local = ijk - (ijk / volume_brick_size) * volume_brick_size;
+  if (local.x < volume_brick_size - 1 && local.y < volume_brick_size - 1 &&
+      local.z < volume_brick_size - 1 && ijk.x < vol.size().x - 1 &&
+      ijk.y < vol.size().y - 1 && ijk.z < vol.size().z - 1) {
+    auto nbricks = get_bricks(vol);
+    auto brick   = ijk / volume_brick_size;
+    if (vol.bricks[((size_t)brick.z * nbricks.y + brick.y) * nbricks.x +
+                   brick.x] < 0)
+      return vol.background;
+  }
+  return eval_volume_generic(vol, uvw, no_interpolation, clamp_to_edge);
+}
+
+// Evaluates batches of points in chunks, in parallel for large batches.
+template <typename Func>
+static void eval_volume_batches(size_t count, Func&& func) {
+  auto chunk   = (size_t)256;
+  auto nchunks = (int)((count + chunk - 1) / chunk);
+  auto run     = [&](int idx) {
+    func(idx * chunk, std::min(count, (idx + 1) * chunk));
+  };
+  if (count < 16384) {
+    for (auto idx = 0; idx < nchunks; idx++) run(idx);
+  } else {
+    parallel_for(nchunks, run);
+  }
+}
+
+// Evaluates a volume at many points. Voxel offsets and weights are computed
+// for a chunk of points in straight loops before gathering voxels.
+void eval_volume(float* values, const volume<float>& vol, const vec3f* uvw,
+    size_t count, bool no_interpolation, bool clamp_to_edge) {
+  if (vol.empty()) {
+    std::fill(values, values + count, 0.0f);
+    return;
+  }
+  if (no_interpolation) {
+    eval_volume_batches(count, [&](size_t start, size_t end) {
+      for (auto idx = start; idx < end; idx++) {
+        values[idx] = eval_volume(vol, uvw[idx], true, clamp_to_edge);
+      }
+    });
+    return;
+  }
+  auto size   = vol.size();
+  auto voxels = vol.data();
+  eval_volume_batches(count, [&](size_t start, size_t end) {
+    size_t offsets[256], di[256], dj[256], dk[256];
+    float  us[256], vs[256], ws[256];
+    auto   num = end - start;
+    for (auto idx = (size_t)0; idx < num; idx++) {
+      auto& p = uvw[start + idx];
+      auto  i = 0, j = 0, k = 0, ii = 0, jj = 0, kk = 0;
+      eval_volume_coord(p.x, size.x, clamp_to_edge, i, ii, us[idx]);
+      eval_volume_coord(p.y, size.y, clamp_to_edge, j, jj, vs[idx]);
+      eval_volume_coord(p.z, size.z, clamp_to_edge, k, kk, ws[idx]);
+      offsets[idx] = ((size_t)k * size.y + j) * size.x + i;
+      di[idx]      = (size_t)(ii - i);
+      dj[idx]      = (size_t)(jj - j) * size.x;
+      dk[idx]      = (size_t)(kk - k) * size.x * size.y;
+    }
+    for (auto idx = (size_t)0; idx < num; idx++) {
+      auto o = offsets[idx], x = di[idx], y = dj[idx], z = dk[idx];
+      auto u = us[idx], v = vs[idx], w = ws[idx];
+      values[start + idx] = voxels[o] * (1 - u) * (1 - v) * (1 - w) +
+                            voxels[o + x] * u * (1 - v) * (1 - w) +
+                            voxels[o + y] * (1 - u) * v * (1 - w) +
+                            voxels[o + z] * (1 - u) * (1 - v) * w +
+                            voxels[o + y + z] * (1 - u) * v * w +
+                            voxels[o + x + z] * u * (1 - v) * w +
+                            voxels[o + x + y] * u * v * (1 - w) +
+                            voxels[o + x + y + z] * u * v * w;
+    }
+  });
+}
+void eval_volume(float* values, const sparse_volume& vol, const vec3f* uvw,
+    size_t count, bool no_interpolation, bool clamp_to_edge) {
+  eval_volume_batches(count, [&](size_t start, size_t end) {
+    for (auto idx = start; idx < end; idx++) {
+      values[idx] = eval_volume(vol, uvw[idx], no_interpolation, clamp_to_edge);
+    }
+  });
+}
+
+// Evaluates a volume mip chain at a level of detail.
+float eval_volume(const std::vector<volume<float>>& mips, const vec3f& uvw,
+    float level, bool no_interpolation, bool clamp_to_edge) {
+  if (mips.empty()) return 0;
+  level       = clamp(level, 0.0f, (float)(mips.size() - 1));
+  auto level0 = (int)level, level1 = min(level0 + 1, (int)mips.size() - 1);
+  auto t      = level - level0;
+  auto value0 = eval_volume(mips[level0], uvw, no_interpolation, clamp_to_edge);
+  if (t == 0) return value0;
+  auto value1 = eval_volume(mips[level1], uvw, no_interpolation, clamp_to_edge);
+  return value0 * (1 - t) + value1 * t;
 }
 
 }  // namespace yocto::image
@@ -1338,31 +2465,31 @@ inline float eval_volume(const volume<float>& vol, const vec3f& uvw,
 namespace yocto::image {
 
 // make a simple example volume
-void make_test(
+void make_voltest(
     volume<float>& vol, const vec3i& size, float scale, float exponent) {
   vol.resize(size);
-  for (auto k = 0; k < vol.size().z; k++) {
-    for (auto j = 0; j < vol.size().y; j++) {
-      for (auto i = 0; i < vol.size().x; i++) {
-        auto p     = vec3f{i / (float)vol.size().x, j / (float)vol.size().y,
-            k / (float)vol.size().z};
+  parallel_for(size.z, [&](int k) {
+    for (auto j = 0; j < size.y; j++) {
+      for (auto i = 0; i < size.x; i++) {
+        auto p     = vec3f{i / (float)size.x, j / (float)size.y,
+            k / (float)size.z};
         auto value = pow(
             max(max(cos(scale * p.x), cos(scale * p.y)), 0.0f), exponent);
         vol[{i, j, k}] = clamp(value, 0.0f, 1.0f);
       }
     }
-  }
+  });
 }
-volume<float> make_test(const vec3i& size, float scale, float exponent) {
+volume<float> make_voltest(const vec3i& size, float scale, float exponent) {
   auto vol = volume<float>{};
-  make_test(vol, size, scale, exponent);
+  make_voltest(vol, size, scale, exponent);
   return vol;
 }
 
 void make_volume_preset(volume<float>& vol, const std::string& type) {
   auto size = vec3i{256, 256, 256};
   if (type == "test-volume") {
-    make_test(vol, size, 6, 10);
+    make_voltest(vol, size, 6, 10);
   } else {
     throw std::runtime_error("unknown volume preset " + type);
   }
@@ -1373,6 +2500,112 @@ volume<float> make_volume_preset(const std::string& type) {
   return vol;
 }
 
+// Number of bricks along each axis.
+vec3i get_bricks(const sparse_volume& vol) {
+  return (vol.extent + volume_brick_size - 1) / volume_brick_size;
+}
+
+// Number of stored voxels.
+size_t count_voxels(const sparse_volume& vol) { return vol.voxels.size(); }
+
+// Build a sparse volume from a voxel accessor `get(ijk)`. Bricks are checked
+// for emptiness in parallel, then the non-empty ones are copied.
+template <typename Get>
+static void make_bricks(sparse_volume& vol, const vec3i& size,
+    float background, Get&& get) {
+  auto bsize     = volume_brick_size;
+  auto nbricks   = (size + bsize - 1) / bsize;
+  auto count     = (size_t)nbricks.x * (size_t)nbricks.y * (size_t)nbricks.z;
+  auto brick_ijk = [&](size_t idx) {
+    return vec3i{(int)(idx % nbricks.x), (int)((idx / nbricks.x) % nbricks.y),
+        (int)(idx / ((size_t)nbricks.x * nbricks.y))};
+  };
+  auto for_voxels = [&](size_t idx, auto&& func) {
+    auto start = brick_ijk(idx) * bsize;
+    auto end   = min(start + bsize, size);
+    for (auto k = start.z; k < end.z; k++) {
+      for (auto j = start.y; j < end.y; j++) {
+        for (auto i = start.x; i < end.x; i++) {
+          auto local = vec3i{i, j, k} - start;
+          func(vec3i{i, j, k}, (local.z * bsize + local.y) * bsize + local.x);
+        }
+      }
+    }
+  };
+
+  vol.extent     = size;
+  vol.background = background;
+  vol.bricks.assign(count, -1);
+  vol.voxels.clear();
+
+  // find non-empty bricks
+  auto used = std::vector<char>(count, 0);
+  parallel_for((int)count, [&](int idx) {
+    for_voxels(idx, [&](const vec3i& ijk, int) {
+      if (get(ijk) != background) used[idx] = 1;
+    });
+  });
+
+  // allocate and copy bricks
+  auto nused = (size_t)0;
+  for (auto idx = (size_t)0; idx < count; idx++) {
+    if (used[idx]) vol.bricks[idx] = (int64_t)(bsize * bsize * bsize * nused++);
+  }
+  vol.voxels.assign(nused * bsize * bsize * bsize, background);
+  parallel_for((int)count, [&](int idx) {
+    if (vol.bricks[idx] < 0) return;
+    auto voxels = vol.voxels.data() + vol.bricks[idx];
+    for_voxels(idx, [&](const vec3i& ijk, int offset) {
+      voxels[offset] = get(ijk);
+    });
+  });
+}
+
+// Make a sparse volume from a dense one.
+sparse_volume make_sparse_volume(const volume<float>& vol, float background) {
+  auto sparse = sparse_volume{};
+  make_bricks(sparse, vol.size(), background,
+      [&](const vec3i& ijk) { return vol[ijk]; });
+  return sparse;
+}
+
+// Downsample a volume by 2 along each axis.
+volume<float> downsample_volume(const volume<float>& vol) {
+  auto size  = max((vol.size() + 1) / 2, vec3i{1, 1, 1});
+  auto small = volume<float>{};
+  small.resize(size);
+  parallel_for(size.z, [&](int k) {
+    for (auto j = 0; j < size.y; j++) {
+      for (auto i = 0; i < size.x; i++) {
+        auto start = vec3i{i, j, k} * 2;
+        auto end   = min(start + 2, vol.size());
+        auto sum = 0.0f, count = 0.0f;
+        for (auto kk = start.z; kk < end.z; kk++) {
+          for (auto jj = start.y; jj < end.y; jj++) {
+            for (auto ii = start.x; ii < end.x; ii++) {
+              sum += vol[{ii, jj, kk}];
+              count += 1;
+            }
+          }
+        }
+        small[{i, j, k}] = sum / count;
+      }
+    }
+  });
+  return small;
+}
+
+// Make a mip chain of a volume.
+std::vector<volume<float>> make_volume_mips(const volume<float>& vol) {
+  auto mips = std::vector<volume<float>>{};
+  if (vol.empty()) return mips;
+  mips.push_back(vol);
+  while (mips.back().size() != vec3i{1, 1, 1}) {
+    mips.push_back(downsample_volume(mips.back()));
+  }
+  return mips;
+}
+
 }  // namespace yocto::image
 
 // -----------------------------------------------------------------------------
@@ -1601,8 +2834,8 @@ bool is_hdr_filename(const std::string& filename) {
 }
 
 // Saves an hdr image.
-[[nodiscard]] bool save_image(
-    const std::string& filename, const image<vec4f>& img, std::string& error) {
+[[nodiscard]] bool save_image(const std::string& filename,
+    const image_view<const vec4f>& img, std::string& error) {
   auto format_error = [filename, &error]() {
     error = filename + ": unknown format";
     return false;
@@ -1612,22 +2845,23 @@ bool is_hdr_filename(const std::string& filename) {
     return false;
   };
 
-  auto ext = get_extension(filename);
+  auto ext    = get_extension(filename);
+  auto buffer = image<vec4f>{};
   if (ext == ".hdr" || ext == ".HDR") {
     if (!stbi_write_hdr(filename.c_str(), img.size().x, img.size().y, 4,
-            (float*)img.data()))
+            (float*)packed_pixels(img, buffer)))
       return write_error();
     return true;
   } else if (ext == ".pfm" || ext == ".PFM") {
     if (!save_pfm(filename.c_str(), img.size().x, img.size().y, 4,
-            (float*)img.data()))
+            (float*)packed_pixels(img, buffer)))
       return write_error();
     return true;
   } else if (ext == ".exr" || ext == ".EXR") {
-    if (SaveEXR((float*)img.data(), img.size().x, img.size().y, 4,
-            filename.c_str()) < 0)
-      return write_error();
-    return true;
+    auto writer = image_writer{};
+    if (!open_image_writer(writer, filename, img.size(), error)) return false;
+    if (!write_image_rows(writer, img, 0, error)) return false;
+    return close_image_writer(writer, error);
   } else if (!is_hdr_filename(filename)) {
     return save_image(filename, rgb_to_srgbb(img), error);
   } else {
@@ -1667,8 +2901,8 @@ bool is_hdr_filename(const std::string& filename) {
 }
 
 // Saves an ldr image.
-[[nodiscard]] bool save_image(
-    const std::string& filename, const image<vec4b>& img, std::string& error) {
+[[nodiscard]] bool save_image(const std::string& filename,
+    const image_view<const vec4b>& img, std::string& error) {
   auto format_error = [filename, &error]() {
     error = filename + ": unknown format";
     return false;
@@ -1678,25 +2912,26 @@ bool is_hdr_filename(const std::string& filename) {
     return false;
   };
 
-  auto ext = get_extension(filename);
+  auto ext    = get_extension(filename);
+  auto buffer = image<vec4b>{};
   if (ext == ".png" || ext == ".PNG") {
     if (!stbi_write_png(filename.c_str(), img.size().x, img.size().y, 4,
-            img.data(), img.size().x * 4))
+            img.data(), (int)(img.stride() * 4)))
       return write_error();
     return true;
   } else if (ext == ".jpg" || ext == ".JPG") {
-    if (!stbi_write_jpg(
-            filename.c_str(), img.size().x, img.size().y, 4, img.data(), 75))
+    if (!stbi_write_jpg(filename.c_str(), img.size().x, img.size().y, 4,
+            packed_pixels(img, buffer), 75))
       return write_error();
     return true;
   } else if (ext == ".tga" || ext == ".TGA") {
-    if (!stbi_write_tga(
-            filename.c_str(), img.size().x, img.size().y, 4, img.data()))
+    if (!stbi_write_tga(filename.c_str(), img.size().x, img.size().y, 4,
+            packed_pixels(img, buffer)))
       return write_error();
     return true;
   } else if (ext == ".bmp" || ext == ".BMP") {
-    if (!stbi_write_bmp(
-            filename.c_str(), img.size().x, img.size().y, 4, img.data()))
+    if (!stbi_write_bmp(filename.c_str(), img.size().x, img.size().y, 4,
+            packed_pixels(img, buffer)))
       return write_error();
     return true;
   } else if (is_hdr_filename(filename)) {
@@ -1725,13 +2960,10 @@ bool is_hdr_filename(const std::string& filename) {
     if (LoadEXR(&pixels, &width, &height, filename.c_str(), nullptr) < 0)
       return read_error();
     if (!pixels) return read_error();
-    auto cpixels = std::unique_ptr<float[]>(new float[width * height * 3]);
-    for (auto i = (size_t)0; i < (size_t)width * (size_t)height; i++) {
-      cpixels[i * 3 + 0] = pixels[i * 4 + 0];
-      cpixels[i * 3 + 1] = pixels[i * 4 + 1];
-      cpixels[i * 3 + 2] = pixels[i * 4 + 2];
+    img = image<vec3f>{{width, height}, uninit};
+    for (auto i = (size_t)0; i < img.count(); i++) {
+      img[i] = {pixels[i * 4 + 0], pixels[i * 4 + 1], pixels[i * 4 + 2]};
     }
-    img = image{{width, height}, (const vec3f*)cpixels.get()};
     free(pixels);
     return true;
   } else if (ext == ".pfm" || ext == ".PFM") {
@@ -1759,8 +2991,8 @@ bool is_hdr_filename(const std::string& filename) {
 }
 
 // Saves an hdr image.
-[[nodiscard]] bool save_image(
-    const std::string& filename, const image<vec3f>& img, std::string& error) {
+[[nodiscard]] bool save_image(const std::string& filename,
+    const image_view<const vec3f>& img, std::string& error) {
   auto format_error = [filename, &error]() {
     error = filename + ": unknown format";
     return false;
@@ -1770,20 +3002,21 @@ bool is_hdr_filename(const std::string& filename) {
     return false;
   };
 
-  auto ext = get_extension(filename);
+  auto ext    = get_extension(filename);
+  auto buffer = image<vec3f>{};
   if (ext == ".hdr" || ext == ".HDR") {
     if (!stbi_write_hdr(filename.c_str(), img.size().x, img.size().y, 3,
-            (float*)img.data()))
+            (float*)packed_pixels(img, buffer)))
       return write_error();
     return true;
   } else if (ext == ".pfm" || ext == ".PFM") {
     if (!save_pfm(filename.c_str(), img.size().x, img.size().y, 3,
-            (float*)img.data()))
+            (float*)packed_pixels(img, buffer)))
       return write_error();
     return true;
   } else if (ext == ".exr" || ext == ".EXR") {
-    if (SaveEXR((float*)img.data(), img.size().x, img.size().y, 3,
-            filename.c_str()) < 0)
+    if (SaveEXR((float*)packed_pixels(img, buffer), img.size().x,
+            img.size().y, 3, filename.c_str()) < 0)
       return write_error();
     return true;
   } else if (!is_hdr_filename(filename)) {
@@ -1825,8 +3058,8 @@ bool is_hdr_filename(const std::string& filename) {
 }
 
 // Saves an ldr image.
-[[nodiscard]] bool save_image(
-    const std::string& filename, const image<vec3b>& img, std::string& error) {
+[[nodiscard]] bool save_image(const std::string& filename,
+    const image_view<const vec3b>& img, std::string& error) {
   auto format_error = [filename, &error]() {
     error = filename + ": unknown format";
     return false;
@@ -1836,25 +3069,26 @@ bool is_hdr_filename(const std::string& filename) {
     return false;
   };
 
-  auto ext = get_extension(filename);
+  auto ext    = get_extension(filename);
+  auto buffer = image<vec3b>{};
   if (ext == ".png" || ext == ".PNG") {
     if (!stbi_write_png(filename.c_str(), img.size().x, img.size().y, 3,
-            img.data(), img.size().x * 3))
+            img.data(), (int)(img.stride() * 3)))
       return write_error();
     return true;
   } else if (ext == ".jpg" || ext == ".JPG") {
-    if (!stbi_write_jpg(
-            filename.c_str(), img.size().x, img.size().y, 3, img.data(), 75))
+    if (!stbi_write_jpg(filename.c_str(), img.size().x, img.size().y, 3,
+            packed_pixels(img, buffer), 75))
       return write_error();
     return true;
   } else if (ext == ".tga" || ext == ".TGA") {
-    if (!stbi_write_tga(
-            filename.c_str(), img.size().x, img.size().y, 3, img.data()))
+    if (!stbi_write_tga(filename.c_str(), img.size().x, img.size().y, 3,
+            packed_pixels(img, buffer)))
       return write_error();
     return true;
   } else if (ext == ".bmp" || ext == ".BMP") {
-    if (!stbi_write_bmp(
-            filename.c_str(), img.size().x, img.size().y, 3, img.data()))
+    if (!stbi_write_bmp(filename.c_str(), img.size().x, img.size().y, 3,
+            packed_pixels(img, buffer)))
       return write_error();
     return true;
   } else if (is_hdr_filename(filename)) {
@@ -1883,12 +3117,10 @@ bool is_hdr_filename(const std::string& filename) {
     if (LoadEXR(&pixels, &width, &height, filename.c_str(), nullptr) < 0)
       return read_error();
     if (!pixels) return read_error();
-    auto cpixels = std::unique_ptr<float[]>(new float[width * height]);
-    for (auto i = (size_t)0; i < (size_t)width * (size_t)height; i++) {
-      cpixels[i + 0] =
-          (pixels[i * 4 + 0] + pixels[i * 4 + 1] + pixels[i * 4 + 2]) / 3;
+    img = image<float>{{width, height}, uninit};
+    for (auto i = (size_t)0; i < img.count(); i++) {
+      img[i] = (pixels[i * 4 + 0] + pixels[i * 4 + 1] + pixels[i * 4 + 2]) / 3;
     }
-    img = image{{width, height}, (const float*)cpixels.get()};
     free(pixels);
     return true;
   } else if (ext == ".pfm" || ext == ".PFM") {
@@ -1916,8 +3148,8 @@ bool is_hdr_filename(const std::string& filename) {
 }
 
 // Saves an hdr image.
-[[nodiscard]] bool save_image(
-    const std::string& filename, const image<float>& img, std::string& error) {
+[[nodiscard]] bool save_image(const std::string& filename,
+    const image_view<const float>& img, std::string& error) {
   auto format_error = [filename, &error]() {
     error = filename + ": unknown format";
     return false;
@@ -1927,14 +3159,18 @@ bool is_hdr_filename(const std::string& filename) {
     return false;
   };
 
-  auto ext = get_extension(filename);
+  auto ext    = get_extension(filename);
+  auto buffer = image<float>{};
   if (ext == ".hdr" || ext == ".HDR") {
     auto npixels = (size_t)img.size().x * (size_t)img.size().y;
     auto cpixels = std::unique_ptr<float[]>(new float[npixels * 3]);
-    for (auto idx = (size_t)0; idx < npixels; idx++) {
-      cpixels[idx * 3 + 0] = *(img.begin() + idx);
-      cpixels[idx * 3 + 1] = *(img.begin() + idx);
-      cpixels[idx * 3 + 2] = *(img.begin() + idx);
+    for (auto j = 0; j < img.size().y; j++) {
+      for (auto i = 0; i < img.size().x; i++) {
+        auto idx             = (size_t)j * (size_t)img.size().x + (size_t)i;
+        cpixels[idx * 3 + 0] = img[{i, j}];
+        cpixels[idx * 3 + 1] = img[{i, j}];
+        cpixels[idx * 3 + 2] = img[{i, j}];
+      }
     }
     if (!stbi_write_hdr(filename.c_str(), img.size().x, img.size().y, 3,
             (float*)cpixels.get()))
@@ -1942,12 +3178,12 @@ bool is_hdr_filename(const std::string& filename) {
     return true;
   } else if (ext == ".pfm" || ext == ".PFM") {
     if (!save_pfm(filename.c_str(), img.size().x, img.size().y, 1,
-            (float*)img.data()))
+            (float*)packed_pixels(img, buffer)))
       return write_error();
     return true;
   } else if (ext == ".exr" || ext == ".EXR") {
-    if (SaveEXR((float*)img.data(), img.size().x, img.size().y, 1,
-            filename.c_str()) < 0)
+    if (SaveEXR((float*)packed_pixels(img, buffer), img.size().x,
+            img.size().y, 1, filename.c_str()) < 0)
       return write_error();
     return true;
   } else if (!is_hdr_filename(filename)) {
@@ -1989,8 +3225,8 @@ bool is_hdr_filename(const std::string& filename) {
 }
 
 // Saves an ldr image.
-[[nodiscard]] bool save_image(
-    const std::string& filename, const image<byte>& img, std::string& error) {
+[[nodiscard]] bool save_image(const std::string& filename,
+    const image_view<const byte>& img, std::string& error) {
   auto format_error = [filename, &error]() {
     error = filename + ": unknown format";
     return false;
@@ -2000,25 +3236,26 @@ bool is_hdr_filename(const std::string& filename) {
     return false;
   };
 
-  auto ext = get_extension(filename);
+  auto ext    = get_extension(filename);
+  auto buffer = image<byte>{};
   if (ext == ".png" || ext == ".PNG") {
     if (!stbi_write_png(filename.c_str(), img.size().x, img.size().y, 1,
-            img.data(), img.size().x * 1))
+            img.data(), (int)(img.stride() * 1)))
       return write_error();
     return true;
   } else if (ext == ".jpg" || ext == ".JPG") {
-    if (!stbi_write_jpg(
-            filename.c_str(), img.size().x, img.size().y, 1, img.data(), 75))
+    if (!stbi_write_jpg(filename.c_str(), img.size().x, img.size().y, 1,
+            packed_pixels(img, buffer), 75))
       return write_error();
     return true;
   } else if (ext == ".tga" || ext == ".TGA") {
-    if (!stbi_write_tga(
-            filename.c_str(), img.size().x, img.size().y, 1, img.data()))
+    if (!stbi_write_tga(filename.c_str(), img.size().x, img.size().y, 1,
+            packed_pixels(img, buffer)))
       return write_error();
     return true;
   } else if (ext == ".bmp" || ext == ".BMP") {
-    if (!stbi_write_bmp(
-            filename.c_str(), img.size().x, img.size().y, 1, img.data()))
+    if (!stbi_write_bmp(filename.c_str(), img.size().x, img.size().y, 1,
+            packed_pixels(img, buffer)))
       return write_error();
     return true;
   } else if (is_hdr_filename(filename)) {
@@ -2031,131 +3268,519 @@ bool is_hdr_filename(const std::string& filename) {
 }  // namespace yocto::image
 
 // -----------------------------------------------------------------------------
-// IMPLEMENTATION FOR VOLUME IMAGE IO
+// IMPLEMENTATION FOR BATCH IMAGE IO
 // -----------------------------------------------------------------------------
 namespace yocto::image {
 
-namespace impl {
+// Loads images on a fixed number of workers, each pulling the next file as
+// soon as it is done, so that at most `max_concurrent` decodes are in flight.
+bool load_images(size_t count,
+    const std::function<bool(size_t index, std::string& error)>& load,
+    std::vector<std::string>& errors, int max_concurrent) {
+  errors.assign(count, "");
+  auto nthreads = (size_t)std::thread::hardware_concurrency();
+  if (max_concurrent > 0) nthreads = (size_t)max_concurrent;
+  nthreads = std::clamp(nthreads, (size_t)1, std::max(count, (size_t)1));
+  auto futures  = std::vector<std::future<void>>{};
+  auto next_idx = std::atomic<size_t>{0};
+  auto failed   = std::atomic<bool>{false};
+  for (auto thread_id = (size_t)0; thread_id < nthreads; thread_id++) {
+    futures.emplace_back(std::async(std::launch::async, [&]() {
+      while (true) {
+        auto idx = next_idx.fetch_add(1);
+        if (idx >= count) break;
+        try {
+          if (!load(idx, errors[idx])) failed = true;
+        } catch (std::exception& exception) {
+          errors[idx] = exception.what();
+          failed      = true;
+        }
+      }
+    }));
+  }
+  for (auto& f : futures) f.get();
+  return !failed;
+}
 
-// Volume load
-static inline float* load_yvol(
-    const char* filename, int* w, int* h, int* d, int* nc, int req) {
-  auto fs = fopen(filename, "rb");
-  if (!fs) return nullptr;
-  auto fs_guard = std::unique_ptr<FILE, void (*)(FILE*)>{
-      fs, [](FILE* f) { fclose(f); }};
+// Loads typed images in parallel.
+template <typename T>
+static bool load_images_batch(const std::vector<std::string>& filenames,
+    std::vector<image<T>>& imgs, std::vector<std::string>& errors,
+    int max_concurrent) {
+  imgs.clear();
+  imgs.resize(filenames.size());
+  return load_images(
+      filenames.size(),
+      [&](size_t idx, std::string& error) {
+        return load_image(filenames[idx], imgs[idx], error);
+      },
+      errors, max_concurrent);
+}
+
+// Loads a batch of images in parallel.
+bool load_images(const std::vector<std::string>& filenames,
+    std::vector<image<vec4f>>& imgs, std::vector<std::string>& errors,
+    int max_concurrent) {
+  return load_images_batch(filenames, imgs, errors, max_concurrent);
+}
+bool load_images(const std::vector<std::string>& filenames,
+    std::vector<image<vec4b>>& imgs, std::vector<std::string>& errors,
+    int max_concurrent) {
+  return load_images_batch(filenames, imgs, errors, max_concurrent);
+}
+bool load_images(const std::vector<std::string>& filenames,
+    std::vector<image<vec3f>>& imgs, std::vector<std::string>& errors,
+    int max_concurrent) {
+  return load_images_batch(filenames, imgs, errors, max_concurrent);
+}
+bool load_images(const std::vector<std::string>& filenames,
+    std::vector<image<vec3b>>& imgs, std::vector<std::string>& errors,
+    int max_concurrent) {
+  return load_images_batch(filenames, imgs, errors, max_concurrent);
+}
+bool load_images(const std::vector<std::string>& filenames,
+    std::vector<image<float>>& imgs, std::vector<std::string>& errors,
+    int max_concurrent) {
+  return load_images_batch(filenames, imgs, errors, max_concurrent);
+}
+bool load_images(const std::vector<std::string>& filenames,
+    std::vector<image<byte>>& imgs, std::vector<std::string>& errors,
+    int max_concurrent) {
+  return load_images_batch(filenames, imgs, errors, max_concurrent);
+}
 
-  // buffer
-  char buffer[4096];
-  auto toks = std::vector<std::string>();
+}  // namespace yocto::image
 
-  // read magic
-  if (!fgets(buffer, sizeof(buffer), fs)) return nullptr;
-  toks = split_string(buffer);
-  if (toks[0] != "YVOL") return nullptr;
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION FOR STREAMING IMAGE IO
+// -----------------------------------------------------------------------------
+namespace yocto::image {
 
-  // read w, h
-  if (!fgets(buffer, sizeof(buffer), fs)) return nullptr;
-  toks = split_string(buffer);
-  *w   = atoi(toks[0].c_str());
-  *h   = atoi(toks[1].c_str());
-  *d   = atoi(toks[2].c_str());
-  *nc  = atoi(toks[3].c_str());
-
-  // read data
-  auto nvoxels = (size_t)(*w) * (size_t)(*h) * (size_t)(*d);
-  auto nvalues = nvoxels * (size_t)(*nc);
-  auto voxels  = std::unique_ptr<float[]>(new float[nvalues]);
-  if (fread(voxels.get(), sizeof(float), nvalues, fs) != nvalues)
-    return nullptr;
+// Appends raw bytes to a buffer.
+static void append_bytes(
+    std::vector<byte>& data, const void* value, size_t size) {
+  data.insert(data.end(), (const byte*)value, (const byte*)value + size);
+}
 
-  // proper number of channels
-  if (!req || *nc == req) return voxels.release();
+// Appends an EXR header attribute.
+static void append_exr_attribute(std::vector<byte>& data, const char* name,
+    const char* type, const void* value, int size) {
+  append_bytes(data, name, strlen(name) + 1);
+  append_bytes(data, type, strlen(type) + 1);
+  append_bytes(data, &size, sizeof(size));
+  append_bytes(data, value, size);
+}
 
-  // pack into channels
-  if (req < 0 || req > 4) {
-    return nullptr;
+// Number of scanlines in each EXR chunk.
+static int exr_block_rows(exr_compression compression) {
+  switch (compression) {
+    case exr_compression::none: return 1;
+    case exr_compression::zip: return 16;
+    case exr_compression::piz: return 32;
+    default: return 1;
   }
-  auto cvoxels = std::unique_ptr<float[]>(new float[req * nvoxels]);
-  for (auto i = 0; i < nvoxels; i++) {
-    auto vp = voxels.get() + i * (*nc);
-    auto cp = cvoxels.get() + i * req;
-    if (*nc == 1) {
-      switch (req) {
-        case 1: cp[0] = vp[0]; break;
-        case 2:
-          cp[0] = vp[0];
-          cp[1] = vp[0];
-          break;
-        case 3:
-          cp[0] = vp[0];
-          cp[1] = vp[0];
-          cp[2] = vp[0];
-          break;
-        case 4:
-          cp[0] = vp[0];
-          cp[1] = vp[0];
-          cp[2] = vp[0];
-          cp[3] = 1;
-          break;
-      }
-    } else if (*nc == 2) {
-      switch (req) {
-        case 1: cp[0] = vp[0]; break;
-        case 2:
-          cp[0] = vp[0];
-          cp[1] = vp[1];
-          break;
-        case 3:
-          cp[0] = vp[0];
-          cp[1] = vp[1];
-          break;
-        case 4:
-          cp[0] = vp[0];
-          cp[1] = vp[1];
-          break;
-      }
-    } else if (*nc == 3) {
-      switch (req) {
-        case 1: cp[0] = vp[0]; break;
-        case 2:
-          cp[0] = vp[0];
-          cp[1] = vp[1];
-          break;
-        case 3:
-          cp[0] = vp[0];
-          cp[1] = vp[1];
-          cp[2] = vp[2];
-          break;
-        case 4:
-          cp[0] = vp[0];
-          cp[1] = vp[1];
-          cp[2] = vp[2];
-          cp[3] = 1;
-          break;
-      }
-    } else if (*nc == 4) {
-      switch (req) {
-        case 1: cp[0] = vp[0]; break;
-        case 2:
-          cp[0] = vp[0];
-          cp[1] = vp[1];
-          break;
-        case 3:
-          cp[0] = vp[0];
-          cp[1] = vp[1];
-          cp[2] = vp[2];
-          break;
-        case 4:
-          cp[0] = vp[0];
-          cp[1] = vp[1];
-          cp[2] = vp[2];
-          cp[3] = vp[3];
-          break;
+}
+
+// Seek to an absolute file offset. Offsets are passed as 64 bits since
+// `long` is 32 bits on some platforms, which breaks files over 2GB.
+static bool seek_file(FILE* fs, uint64_t offset) {
+#ifdef _WIN32
+  return _fseeki64(fs, (__int64)offset, SEEK_SET) == 0;
+#else
+  static_assert(sizeof(off_t) >= 8, "64-bit file offsets required");
+  return fseeko(fs, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+// Rows in a given block, since the last one may be partial.
+static int writer_block_rows(const image_writer& writer, int block) {
+  return min(writer.block_rows, writer.extent.y - block * writer.block_rows);
+}
+
+// HDR scanlines are stored as runs of literals, so that all rows have the
+// same size and can be written in any order.
+static size_t hdr_row_size(int width) {
+  if (width < 8 || width > 0x7fff) return (size_t)width * 4;
+  return 4 + 4 * ((size_t)width + ((size_t)width + 127) / 128);
+}
+
+// Convert a color to shared-exponent RGBE.
+static vec4b rgb_to_rgbe(const vec3f& rgb_) {
+  auto rgb = max(rgb_, 0.0f);
+  auto v   = max(rgb);
+  if (v < 1e-32f) return {0, 0, 0, 0};
+  auto e     = 0;
+  auto scale = std::frexp(v, &e) * 256 / v;
+  return {(byte)(rgb.x * scale), (byte)(rgb.y * scale), (byte)(rgb.z * scale),
+      (byte)(e + 128)};
+}
+
+// Writes a single HDR scanline.
+static bool write_hdr_row(image_writer& writer, const vec4f* row, int j) {
+  auto width = writer.extent.x;
+  auto rgbe  = std::vector<vec4b>(width);
+  for (auto i = 0; i < width; i++) rgbe[i] = rgb_to_rgbe(xyz(row[i]));
+  auto data = std::vector<byte>{};
+  if (width < 8 || width > 0x7fff) {
+    append_bytes(data, rgbe.data(), rgbe.size() * sizeof(vec4b));
+  } else {
+    auto line = vec4b{2, 2, (byte)(width >> 8), (byte)(width & 0xff)};
+    append_bytes(data, &line, sizeof(line));
+    for (auto c = 0; c < 4; c++) {
+      for (auto start = 0; start < width; start += 128) {
+        auto count = min(128, width - start);
+        data.push_back((byte)count);
+        for (auto i = start; i < start + count; i++) data.push_back(rgbe[i][c]);
       }
     }
   }
-  return cvoxels.release();
+  auto offset = writer.header_size + (size_t)j * hdr_row_size(width);
+  if (!seek_file(writer.fs, offset)) return false;
+  return fwrite(data.data(), 1, data.size(), writer.fs) == data.size();
+}
+
+// Compresses a completed block with tinyexr and appends it as a chunk.
+static bool write_exr_block(image_writer& writer, int block) {
+  auto width   = writer.extent.x;
+  auto height  = writer_block_rows(writer, block);
+  auto npixels = (size_t)width * (size_t)height;
+  auto& pixels = writer.blocks[block];
+
+  // split channels in A, B, G, R order
+  auto planes = std::vector<float>(npixels * 4);
+  for (auto idx = (size_t)0; idx < npixels; idx++) {
+    for (auto c = 0; c < 4; c++) planes[c * npixels + idx] = pixels[idx][3 - c];
+  }
+  float* images[4] = {planes.data(), planes.data() + npixels,
+      planes.data() + npixels * 2, planes.data() + npixels * 3};
+
+  // encode the block as a single-chunk image
+  auto channels        = std::array<EXRChannelInfo, 4>{};
+  auto pixel_types     = std::array<int, 4>{};
+  auto requested_types = std::array<int, 4>{};
+  auto names           = std::array<const char*, 4>{"A", "B", "G", "R"};
+  for (auto c = 0; c < 4; c++) {
+    strcpy(channels[c].name, names[c]);
+    pixel_types[c]     = TINYEXR_PIXELTYPE_FLOAT;
+    requested_types[c] = writer.half ? TINYEXR_PIXELTYPE_HALF
+                                     : TINYEXR_PIXELTYPE_FLOAT;
+  }
+  auto header = EXRHeader{};
+  InitEXRHeader(&header);
+  header.num_channels          = 4;
+  header.channels              = channels.data();
+  header.pixel_types           = pixel_types.data();
+  header.requested_pixel_types = requested_types.data();
+  switch (writer.compression) {
+    case exr_compression::none:
+      header.compression_type = TINYEXR_COMPRESSIONTYPE_NONE;
+      break;
+    case exr_compression::zip:
+      header.compression_type = TINYEXR_COMPRESSIONTYPE_ZIP;
+      break;
+    case exr_compression::piz:
+      header.compression_type = TINYEXR_COMPRESSIONTYPE_PIZ;
+      break;
+  }
+  auto exr = EXRImage{};
+  InitEXRImage(&exr);
+  exr.num_channels = 4;
+  exr.images       = (unsigned char**)images;
+  exr.width        = width;
+  exr.height       = height;
+  auto memory      = (unsigned char*)nullptr;
+  auto size = SaveEXRImageToMemory(&exr, &header, &memory, nullptr);
+  if (!size || !memory) return false;
+  auto memory_guard = std::unique_ptr<unsigned char, void (*)(void*)>{
+      memory, free};
+
+  // skip header and offset table, then relocate the chunk
+  auto pos = (size_t)8;
+  while (pos < size && memory[pos] != 0) {
+    pos += strlen((const char*)memory + pos) + 1;
+    pos += strlen((const char*)memory + pos) + 1;
+    auto attribute_size = 0;
+    memcpy(&attribute_size, memory + pos, sizeof(attribute_size));
+    pos += sizeof(attribute_size) + attribute_size;
+  }
+  pos += 1 + sizeof(uint64_t);
+  if (pos + 8 > size) return false;
+  auto y = block * writer.block_rows;
+  memcpy(memory + pos, &y, sizeof(y));
+  if (!seek_file(writer.fs, writer.next_offset)) return false;
+  if (fwrite(memory + pos, 1, size - pos, writer.fs) != size - pos)
+    return false;
+  writer.offsets[block] = writer.next_offset;
+  writer.next_offset += size - pos;
+
+  // release the block
+  pixels = {};
+  return true;
+}
+
+// Close the file on destruction without finalizing it.
+image_writer::~image_writer() {
+  if (fs) fclose(fs);
+}
+
+// Opens a streaming writer.
+bool open_image_writer(image_writer& writer, const std::string& filename,
+    const vec2i& size, std::string& error, exr_compression compression,
+    bool half) {
+  auto format_error = [filename, &error]() {
+    error = filename + ": unknown format";
+    return false;
+  };
+  auto write_error = [filename, &error]() {
+    error = filename + ": write error";
+    return false;
+  };
+
+  auto ext = get_extension(filename);
+  if (ext != ".exr" && ext != ".EXR" && ext != ".hdr" && ext != ".HDR")
+    return format_error();
+  if (size.x <= 0 || size.y <= 0)
+    throw std::invalid_argument("bad image size in writer");
+
+  if (writer.fs) fclose(writer.fs);
+  writer.filename    = filename;
+  writer.extent      = size;
+  writer.compression = compression;
+  writer.half        = half;
+  writer.exr         = ext == ".exr" || ext == ".EXR";
+  writer.block_rows  = writer.exr ? exr_block_rows(compression) : 1;
+  auto nblocks       = (size.y + writer.block_rows - 1) / writer.block_rows;
+  writer.filled.assign(nblocks, 0);
+  writer.blocks.assign(writer.exr ? nblocks : 0, {});
+  writer.offsets.assign(writer.exr ? nblocks : 0, 0);
+  writer.fs = fopen(filename.c_str(), "wb");
+  if (!writer.fs) return write_error();
+
+  auto header = std::vector<byte>{};
+  if (writer.exr) {
+    auto magic = std::array<byte, 8>{0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0};
+    append_bytes(header, magic.data(), magic.size());
+    auto channels = std::vector<byte>{};
+    for (auto name : {"A", "B", "G", "R"}) {
+      auto type     = half ? 1 : 2;
+      auto linear   = std::array<byte, 4>{0, 0, 0, 0};
+      auto sampling = vec2i{1, 1};
+      append_bytes(channels, name, strlen(name) + 1);
+      append_bytes(channels, &type, sizeof(type));
+      append_bytes(channels, linear.data(), linear.size());
+      append_bytes(channels, &sampling, sizeof(sampling));
+    }
+    channels.push_back(0);
+    append_exr_attribute(header, "channels", "chlist", channels.data(),
+        (int)channels.size());
+    auto compression_type = (byte)0;
+    switch (compression) {
+      case exr_compression::none:
+        compression_type = TINYEXR_COMPRESSIONTYPE_NONE;
+        break;
+      case exr_compression::zip:
+        compression_type = TINYEXR_COMPRESSIONTYPE_ZIP;
+        break;
+      case exr_compression::piz:
+        compression_type = TINYEXR_COMPRESSIONTYPE_PIZ;
+        break;
+    }
+    append_exr_attribute(
+        header, "compression", "compression", &compression_type, 1);
+    auto window = vec4i{0, 0, size.x - 1, size.y - 1};
+    append_exr_attribute(header, "dataWindow", "box2i", &window, 16);
+    append_exr_attribute(header, "displayWindow", "box2i", &window, 16);
+    auto line_order = (byte)0;
+    append_exr_attribute(header, "lineOrder", "lineOrder", &line_order, 1);
+    auto aspect = 1.0f;
+    append_exr_attribute(header, "pixelAspectRatio", "float", &aspect, 4);
+    auto center = vec2f{0, 0};
+    append_exr_attribute(header, "screenWindowCenter", "v2f", &center, 8);
+    auto window_width = 1.0f;
+    append_exr_attribute(
+        header, "screenWindowWidth", "float", &window_width, 4);
+    header.push_back(0);
+    writer.header_size = header.size();
+    writer.next_offset = header.size() + sizeof(uint64_t) * nblocks;
+    // placeholder offset table, filled when closing
+    header.resize(writer.next_offset, 0);
+  } else {
+    auto text = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " +
+                std::to_string(size.y) + " +X " + std::to_string(size.x) +
+                "\n";
+    append_bytes(header, text.data(), text.size());
+    writer.header_size = header.size();
+  }
+  if (fwrite(header.data(), 1, header.size(), writer.fs) != header.size())
+    return write_error();
+  return true;
+}
+
+// Writes full-width rows.
+bool write_image_rows(image_writer& writer, const image_view<const vec4f>& rows,
+    int start, std::string& error) {
+  auto write_error = [&writer, &error]() {
+    error = writer.filename + ": write error";
+    return false;
+  };
+
+  if (!writer.fs) throw std::invalid_argument("image writer not open");
+  if (rows.size().x != writer.extent.x || start < 0 ||
+      start + rows.size().y > writer.extent.y)
+    throw std::invalid_argument("rows outside of image");
+
+  for (auto j = 0; j < rows.size().y; j++) {
+    auto y = start + j;
+    if (!writer.exr) {
+      if (!write_hdr_row(writer, rows.row(j), y)) return write_error();
+      writer.filled[y] += 1;
+      continue;
+    }
+    auto  block  = y / writer.block_rows;
+    auto& pixels = writer.blocks[block];
+    if (pixels.empty())
+      pixels.resize((size_t)writer.extent.x * writer_block_rows(writer, block));
+    auto row = rows.row(j);
+    std::copy(row, row + writer.extent.x,
+        pixels.data() + (size_t)(y % writer.block_rows) * writer.extent.x);
+    writer.filled[block] += 1;
+    if (writer.filled[block] == writer_block_rows(writer, block)) {
+      if (!write_exr_block(writer, block)) return write_error();
+    }
+  }
+  return true;
+}
+
+// Finalizes the file.
+bool close_image_writer(image_writer& writer, std::string& error) {
+  auto write_error = [&writer, &error]() {
+    error = writer.filename + ": write error";
+    return false;
+  };
+
+  if (!writer.fs) throw std::invalid_argument("image writer not open");
+  auto fs_guard = std::unique_ptr<FILE, void (*)(FILE*)>{
+      writer.fs, [](FILE* f) { fclose(f); }};
+  writer.fs = nullptr;
+
+  for (auto block = 0; block < (int)writer.filled.size(); block++) {
+    if (writer.filled[block] != writer_block_rows(writer, block)) {
+      error = writer.filename + ": missing rows";
+      return false;
+    }
+  }
+  if (writer.exr) {
+    if (!seek_file(fs_guard.get(), writer.header_size)) return write_error();
+    if (fwrite(writer.offsets.data(), sizeof(uint64_t), writer.offsets.size(),
+            fs_guard.get()) != writer.offsets.size())
+      return write_error();
+  }
+  writer.blocks  = {};
+  writer.filled  = {};
+  writer.offsets = {};
+  if (fclose(fs_guard.release()) != 0) return write_error();
+  return true;
+}
+
+}  // namespace yocto::image
+
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION FOR VOLUME IMAGE IO
+// -----------------------------------------------------------------------------
+namespace yocto::image {
+
+namespace impl {
+
+// Read-only view of a file, memory mapped where supported and read into
+// memory otherwise.
+struct mapped_file {
+  const char*       data   = nullptr;
+  size_t            size   = 0;
+  std::vector<char> buffer = {};
+#ifndef _WIN32
+  void* mapped = nullptr;
+#endif
+
+  mapped_file() = default;
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+  ~mapped_file() {
+#ifndef _WIN32
+    if (mapped) munmap(mapped, size);
+#endif
+  }
+};
+
+// Map a file for reading.
+static bool map_file(mapped_file& file, const std::string& filename) {
+#ifndef _WIN32
+  auto fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat stats;
+  if (fstat(fd, &stats) < 0 || stats.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  auto mapped = mmap(nullptr, stats.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) return false;
+  madvise(mapped, stats.st_size, MADV_SEQUENTIAL);
+  file.mapped = mapped;
+  file.data   = (const char*)mapped;
+  file.size   = (size_t)stats.st_size;
+  return true;
+#else
+  auto fs = fopen(filename.c_str(), "rb");
+  if (!fs) return false;
+  auto fs_guard = std::unique_ptr<FILE, void (*)(FILE*)>{
+      fs, [](FILE* f) { fclose(f); }};
+  _fseeki64(fs, 0, SEEK_END);
+  auto size = _ftelli64(fs);
+  _fseeki64(fs, 0, SEEK_SET);
+  if (size <= 0) return false;
+  file.buffer.resize(size);
+  if (fread(file.buffer.data(), 1, size, fs) != (size_t)size) return false;
+  file.data = file.buffer.data();
+  file.size = file.buffer.size();
+  return true;
+#endif
+}
+
+// Parse a yvol header from a mapped file. Returns the payload offset, or 0
+// if the header is invalid or the payload truncated.
+static size_t parse_yvol(const mapped_file& file, vec3i& size, int& ncomp) {
+  auto line_end = [&](size_t start) {
+    auto end = (const char*)memchr(
+        file.data + start, '\n', std::min(file.size - start, (size_t)4096));
+    return end ? (size_t)(end - file.data) + 1 : (size_t)0;
+  };
+  auto magic_end = line_end(0);
+  if (!magic_end) return 0;
+  auto magic = split_string(std::string(file.data, magic_end));
+  if (magic.empty() || magic[0] != "YVOL") return 0;
+  auto size_end = line_end(magic_end);
+  if (!size_end) return 0;
+  auto toks = split_string(
+      std::string(file.data + magic_end, size_end - magic_end));
+  if (toks.size() < 4) return 0;
+  size  = vec3i{atoi(toks[0].c_str()), atoi(toks[1].c_str()),
+      atoi(toks[2].c_str())};
+  ncomp = atoi(toks[3].c_str());
+  if (size.x <= 0 || size.y <= 0 || size.z <= 0 || ncomp <= 0) return 0;
+  auto nvalues = (size_t)size.x * (size_t)size.y * (size_t)size.z *
+                 (size_t)ncomp;
+  if (file.size - size_end < nvalues * sizeof(float)) return 0;
+  return size_end;
+}
+
+// First channel of a voxel in a yvol payload. The payload is not aligned,
+// so values are copied out.
+static float get_yvol_voxel(const char* payload, const vec3i& size,
+    int ncomp, const vec3i& ijk) {
+  auto idx = (((size_t)ijk.z * size.y + ijk.y) * size.x + ijk.x) * ncomp;
+  auto value = 0.0f;
+  memcpy(&value, payload + idx * sizeof(float), sizeof(float));
+  return value;
 }
 
 // save pfm
@@ -2181,11 +3806,45 @@ bool load_volume(
     error = filename + ": read error";
     return false;
   };
-  auto width = 0, height = 0, depth = 0, ncomp = 0;
-  auto voxels = load_yvol(filename.c_str(), &width, &height, &depth, &ncomp, 1);
-  if (!voxels) return read_error();
-  vol = volume{{width, height, depth}, (const float*)voxels};
-  delete[] voxels;
+  auto file = mapped_file{};
+  if (!map_file(file, filename)) return read_error();
+  auto size   = zero3i;
+  auto ncomp  = 0;
+  auto offset = parse_yvol(file, size, ncomp);
+  if (!offset) return read_error();
+  auto payload = file.data + offset;
+  vol.resize(size);
+  if (ncomp == 1) {
+    memcpy(vol.data(), payload, vol.count() * sizeof(float));
+  } else {
+    parallel_for(size.z, [&](int k) {
+      for (auto j = 0; j < size.y; j++) {
+        for (auto i = 0; i < size.x; i++) {
+          vol[{i, j, k}] = get_yvol_voxel(payload, size, ncomp, {i, j, k});
+        }
+      }
+    });
+  }
+  return true;
+}
+
+// Loads volume data from binary format into a sparse volume.
+bool load_volume(const std::string& filename, sparse_volume& vol,
+    std::string& error, float background) {
+  auto read_error = [filename, &error]() {
+    error = filename + ": read error";
+    return false;
+  };
+  auto file = mapped_file{};
+  if (!map_file(file, filename)) return read_error();
+  auto size   = zero3i;
+  auto ncomp  = 0;
+  auto offset = parse_yvol(file, size, ncomp);
+  if (!offset) return read_error();
+  auto payload = file.data + offset;
+  make_bricks(vol, size, background, [&](const vec3i& ijk) {
+    return get_yvol_voxel(payload, size, ncomp, ijk);
+  });
   return true;
 }
 
@@ -2209,6 +3868,10 @@ bool load_volume(
     const std::string& filename, volume<float>& vol, std::string& error) {
   return impl::load_volume(filename, vol, error);
 }
+bool load_volume(const std::string& filename, sparse_volume& vol,
+    std::string& error, float background) {
+  return impl::load_volume(filename, vol, error, background);
+}
 
 // Saves volume data in binary format.
 bool save_volume(
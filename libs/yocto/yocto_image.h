@@ -17,6 +17,8 @@
 // Yocto/Math contains a simple image container that can be used to store
 // generic images. The container is similar in spirit to `std::std::vector`.
 // We provide only minimal image functions including lookup and sampling.
+// Non-owning `image_view<T>`s refer to images, image regions or external
+// buffers with a row stride, and are accepted by read-only image functions.
 //
 //
 // ## Image Utilities
@@ -97,8 +99,17 @@
 // -----------------------------------------------------------------------------
 
 #include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "yocto_math.h"
@@ -132,6 +143,43 @@ using math::zero4f;
 // -----------------------------------------------------------------------------
 namespace yocto::image {
 
+// Tag used to allocate images without initializing their pixels. Use it only
+// when every pixel is written before being read.
+struct uninit_t {};
+inline constexpr auto uninit = uninit_t{};
+
+// Enables recycling of image buffers. Freed buffers, up to `capacity` bytes in
+// total, are retained and reused by later allocations of the same size.
+// Useful when images of the same size are allocated over and over, e.g. in
+// interactive viewers. A capacity of 0 disables the pool and frees buffers.
+void set_image_pool_capacity(size_t capacity);
+
+// Image buffer allocation. Buffers are aligned to 64 bytes for SIMD access
+// and are drawn from the image pool, if enabled.
+namespace impl {
+void* allocate_image_buffer(size_t size);
+void  free_image_buffer(void* buffer, size_t size);
+}  // namespace impl
+
+// Allocator used for image pixels. Default construction of trivially copyable
+// pixels does nothing, so that storage can be allocated uninitialized.
+template <typename T>
+struct image_allocator {
+  using value_type = T;
+
+  image_allocator() = default;
+  template <typename U>
+  image_allocator(const image_allocator<U>&) {}
+
+  T*   allocate(size_t n);
+  void deallocate(T* buffer, size_t n);
+
+  template <typename U>
+  void construct(U* ptr);
+  template <typename U, typename... Args>
+  void construct(U* ptr, Args&&... args);
+};
+
 // Image container.
 template <typename T>
 struct image {
@@ -139,6 +187,7 @@ struct image {
   image();
   image(const vec2i& size, const T& value = {});
   image(const vec2i& size, const T* value);
+  image(const vec2i& size, uninit_t);
 
   // size
   bool   empty() const;
@@ -146,6 +195,7 @@ struct image {
   size_t count() const;
   bool   contains(const vec2i& ij) const;
   void   resize(const vec2i& size);
+  void   resize(const vec2i& size, uninit_t);
   void   assign(const vec2i& size, const T& value = {});
   void   shrink_to_fit();
   void   swap(image& other);
@@ -168,8 +218,8 @@ struct image {
 
  private:
   // data
-  vec2i          extent = {0, 0};
-  std::vector<T> pixels = {};
+  vec2i                              extent = {0, 0};
+  std::vector<T, image_allocator<T>> pixels = {};
 };
 
 // equality
@@ -182,6 +232,67 @@ inline bool operator!=(const image<T>& a, const image<T>& b);
 template <typename T>
 inline void swap(image<T>& a, image<T>& b);
 
+// Non-owning image view. Stores a pointer to the pixels, the view size and the
+// row stride in pixels. Views can refer to images, to rectangular regions of
+// images or to externally-owned buffers. Use `image_view<const T>` for
+// read-only access. Views are cheap to copy and never own their data.
+template <typename T>
+struct image_view {
+  // constructors
+  image_view();
+  image_view(T* data, const vec2i& size);
+  image_view(T* data, const vec2i& size, size_t stride);
+  template <typename U,
+      typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+  image_view(image<U>& img);
+  template <typename U,
+      typename = std::enable_if_t<std::is_convertible_v<const U*, T*>>>
+  image_view(const image<U>& img);
+  template <typename U,
+      typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+  image_view(const image_view<U>& view);
+
+  // size
+  bool   empty() const;
+  vec2i  size() const;
+  size_t count() const;
+  size_t stride() const;
+  bool   contiguous() const;
+  bool   contains(const vec2i& ij) const;
+
+  // element access
+  T& operator[](const vec2i& ij) const;
+
+  // data access
+  T* data() const;
+  T* row(int j) const;
+
+ private:
+  // data
+  T*     pixels = nullptr;
+  vec2i  extent = {0, 0};
+  size_t pitch  = 0;
+};
+
+// Views of a region of an image. The region is clipped to the image bounds.
+template <typename T>
+inline image_view<T> get_view(
+    const image_view<T>& view, const vec2i& offset, const vec2i& size);
+template <typename T>
+inline image_view<T> get_view(
+    image<T>& img, const vec2i& offset, const vec2i& size);
+template <typename T>
+inline image_view<const T> get_view(
+    const image<T>& img, const vec2i& offset, const vec2i& size);
+
+// Copy a view into an owning image, packing the rows.
+template <typename T>
+inline image<std::remove_const_t<T>> copy_image(const image_view<T>& view);
+// Copy pixels between views of the same size.
+template <typename T>
+inline void copy_pixels(
+    const image_view<T>& dst, const image_view<const T>& src);
+
 }  // namespace yocto::image
 
 // -----------------------------------------------------------------------------
@@ -206,37 +317,80 @@ vec3f eval_image(const image<vec3b>& img, const vec2f& uv, bool as_linear,
 // -----------------------------------------------------------------------------
 namespace yocto::image {
 
+// Whole-image operations below process rows in parallel for large images.
+
 // Conversion from/to floats.
-image<vec4f> byte_to_float(const image<vec4b>& bt);
-image<vec4b> float_to_byte(const image<vec4f>& fl);
-image<vec3f> byte_to_float(const image<vec3b>& bt);
-image<vec3b> float_to_byte(const image<vec3f>& fl);
-image<float> byte_to_float(const image<byte>& bt);
-image<byte>  float_to_byte(const image<float>& fl);
+image<vec4f> byte_to_float(const image_view<const vec4b>& bt);
+image<vec4b> float_to_byte(const image_view<const vec4f>& fl);
+image<vec3f> byte_to_float(const image_view<const vec3b>& bt);
+image<vec3b> float_to_byte(const image_view<const vec3f>& fl);
+image<float> byte_to_float(const image_view<const byte>& bt);
+image<byte>  float_to_byte(const image_view<const float>& fl);
 
 // Conversion between linear and gamma-encoded images.
-image<vec4f> srgb_to_rgb(const image<vec4f>& srgb);
-image<vec4f> rgb_to_srgb(const image<vec4f>& rgb);
-image<vec4f> srgb_to_rgb(const image<vec4b>& srgb);
-image<vec4b> rgb_to_srgbb(const image<vec4f>& rgb);
-image<vec3f> srgb_to_rgb(const image<vec3f>& srgb);
-image<vec3f> rgb_to_srgb(const image<vec3f>& rgb);
-image<vec3f> srgb_to_rgb(const image<vec3b>& srgb);
-image<vec3b> rgb_to_srgbb(const image<vec3f>& rgb);
-image<float> srgb_to_rgb(const image<float>& srgb);
-image<float> rgb_to_srgb(const image<float>& rgb);
-image<float> srgb_to_rgb(const image<byte>& srgb);
-image<byte>  rgb_to_srgbb(const image<float>& rgb);
+image<vec4f> srgb_to_rgb(const image_view<const vec4f>& srgb);
+image<vec4f> rgb_to_srgb(const image_view<const vec4f>& rgb);
+image<vec4f> srgb_to_rgb(const image_view<const vec4b>& srgb);
+image<vec4b> rgb_to_srgbb(const image_view<const vec4f>& rgb);
+image<vec3f> srgb_to_rgb(const image_view<const vec3f>& srgb);
+image<vec3f> rgb_to_srgb(const image_view<const vec3f>& rgb);
+image<vec3f> srgb_to_rgb(const image_view<const vec3b>& srgb);
+image<vec3b> rgb_to_srgbb(const image_view<const vec3f>& rgb);
+image<float> srgb_to_rgb(const image_view<const float>& srgb);
+image<float> rgb_to_srgb(const image_view<const float>& rgb);
+image<float> srgb_to_rgb(const image_view<const byte>& srgb);
+image<byte>  rgb_to_srgbb(const image_view<const float>& rgb);
 
 // Apply tone mapping
-image<vec4f> tonemap_image(const image<vec4f>& hdr, float exposure,
+image<vec4f> tonemap_image(const image_view<const vec4f>& hdr, float exposure,
     bool filmic = false, bool srgb = true);
-image<vec4b> tonemap_imageb(const image<vec4f>& hdr, float exposure,
+image<vec4b> tonemap_imageb(const image_view<const vec4f>& hdr, float exposure,
     bool filmic = false, bool srgb = true);
 
-// Apply tone mapping using multithreading for speed
-void tonemap_image_mt(image<vec4f>& ldr, const image<vec4f>& hdr,
+// Apply tone mapping using multithreading for speed. The byte version
+// quantizes in the same pass, avoiding an intermediate float image.
+void tonemap_image_mt(image<vec4f>& ldr, const image_view<const vec4f>& hdr,
     float exposure, bool filmic = false, bool srgb = true);
+void tonemap_image_mt(image<vec4b>& ldr, const image_view<const vec4f>& hdr,
+    float exposure, bool filmic = false, bool srgb = true);
+
+// Local tone mapping parameters. Log luminance is split into a base layer,
+// smoothed with an edge-preserving bilateral grid, and a detail layer.
+// The base is compressed to `contrast` stops around its mean, while details
+// are scaled by `detail`. The spatial sigma is a fraction of the image size
+// and the range sigma is in stops.
+struct local_tonemap_params {
+  float contrast      = 5;
+  float detail        = 1;
+  float spatial_sigma = 0.03f;
+  float range_sigma   = 1;
+};
+
+// Compress the dynamic range of an HDR image with local tone mapping. Runs
+// in linear time, with parallel splat, blur and slice stages. The result is
+// still linear and can be tone mapped globally.
+image<vec4f> local_tonemap_image(const image_view<const vec4f>& hdr,
+    const local_tonemap_params& params = {});
+
+// Apply local tone mapping followed by exposure and filmic tone mapping.
+image<vec4f> tonemap_image(const image_view<const vec4f>& hdr, float exposure,
+    const local_tonemap_params& local, bool filmic = false, bool srgb = true);
+
+// Bloom parameters. Highlights brighter than `threshold` are blurred over
+// a pyramid of `levels` images of halving resolution, and added back scaled
+// by `intensity`. Each coarser level is weighted by `radius` relative to the
+// previous one, so larger values spread the glow further.
+struct bloom_params {
+  float intensity = 0.1f;
+  float threshold = 1;
+  float radius    = 0.7f;
+  int   levels    = 6;
+};
+
+// Add bloom to an HDR image. Runs in time linear in the number of pixels,
+// independently of the glow radius. The result is still linear.
+image<vec4f> bloom_image(
+    const image_view<const vec4f>& hdr, const bloom_params& params = {});
 
 // minimal color grading
 struct colorgrade_params {
@@ -264,24 +418,140 @@ vec4f colorgrade(
     const vec4f& rgb, bool linear, const colorgrade_params& params);
 
 // Color grade a linear or srgb image to an srgb image.
-image<vec4f> colorgrade_image(
-    const image<vec4f>& img, bool linear, const colorgrade_params& params);
+image<vec4f> colorgrade_image(const image_view<const vec4f>& img,
+    bool linear, const colorgrade_params& params);
+image<vec4b> colorgrade_imageb(const image_view<const vec4f>& img,
+    bool linear, const colorgrade_params& params);
 
 // Color grade a linear or srgb image to an srgb image.
 // Uses multithreading for speed.
-void colorgrade_image_mt(image<vec4f>& corrected, const image<vec4f>& img,
-    bool linear, const colorgrade_params& params);
+void colorgrade_image_mt(image<vec4f>& corrected,
+    const image_view<const vec4f>& img, bool linear,
+    const colorgrade_params& params);
+void colorgrade_image_mt(image<vec4b>& corrected,
+    const image_view<const vec4f>& img, bool linear,
+    const colorgrade_params& params);
 
 // determine white balance colors
-vec3f compute_white_balance(const image<vec4f>& img);
+vec3f compute_white_balance(const image_view<const vec4f>& img);
+
+// Image statistics computed in one parallel pass. Channel histograms cover
+// values in [0, max_value], while the luminance histogram covers log2
+// luminance in [min_log2, max_log2]. Out of range values go to end bins.
+struct image_stats {
+  vec4f min           = zero4f;
+  vec4f max           = zero4f;
+  vec4f mean          = zero4f;
+  float min_luminance = 0;
+  float max_luminance = 0;
+  float log_average   = 0;  // geometric mean of luminance
+  float max_value     = 1;
+  float min_log2      = -16;
+  float max_log2      = 16;
+  std::array<std::vector<size_t>, 3> channel_histograms  = {};
+  std::vector<size_t>                luminance_histogram = {};
+};
+
+// Compute image statistics with `bins` bins per histogram.
+image_stats compute_image_stats(const image_view<const vec4f>& img,
+    int bins = 256, float max_value = 1, float min_log2 = -16,
+    float max_log2 = 16);
+
+// Value below which a fraction `percentile` of the pixels fall, estimated
+// from the histograms by interpolating within bins.
+float get_percentile(const image_stats& stats, int channel, float percentile);
+float get_luminance_percentile(const image_stats& stats, float percentile);
+
+// Exposure, in stops, that maps the average log luminance of the pixels
+// between the `low` and `high` percentiles to `key`.
+float compute_auto_exposure(const image_stats& stats, float key = 0.18f,
+    float low = 0.05f, float high = 0.95f);
+
+// Blur filters with a constant cost per pixel, independent of the radius.
+// Rows are filtered in parallel and vertical passes run on a transposed
+// copy of the image, so all passes read memory sequentially. Edges are
+// clamped.
+//
+// Box blur over a window of 2 * radius + 1 pixels, repeated `passes` times.
+image<vec4f> box_blur_image(
+    const image_view<const vec4f>& img, int radius, int passes = 1);
+image<float> box_blur_image(
+    const image_view<const float>& img, int radius, int passes = 1);
+// Gaussian blur with the recursive filter of Young and van Vliet, or with
+// three stacked box blurs when `recursive` is false.
+image<vec4f> gaussian_blur_image(
+    const image_view<const vec4f>& img, float sigma, bool recursive = true);
+image<float> gaussian_blur_image(
+    const image_view<const float>& img, float sigma, bool recursive = true);
 
 // Resize an image.
-image<vec4f> resize_image(const image<vec4f>& img, const vec2i& size);
-image<vec4b> resize_image(const image<vec4b>& img, const vec2i& size);
+image<vec4f> resize_image(
+    const image_view<const vec4f>& img, const vec2i& size);
+image<vec4b> resize_image(
+    const image_view<const vec4b>& img, const vec2i& size);
 
 // Compute the difference between two images
-image<vec4f> image_difference(
-    const image<vec4f>& a, const image<vec4f>& b, bool disply_diff);
+image<vec4f> image_difference(const image_view<const vec4f>& a,
+    const image_view<const vec4f>& b, bool disply_diff);
+
+// Comparison metrics between an image and a reference. Errors are computed
+// on rgb, while SSIM uses luminance, so tonemap hdr images first if a
+// perceptual SSIM is needed. Tile errors hold the max error of each tile.
+struct image_metrics {
+  double       mse         = 0;  // mean squared error
+  double       psnr        = 0;  // peak signal-to-noise ratio for a peak of 1
+  double       relmse      = 0;  // mean squared error relative to reference
+  double       ssim        = 0;  // mean structural similarity
+  float        max_error   = 0;  // max absolute error
+  image<float> ssim_map    = {};
+  image<float> tile_errors = {};
+};
+
+// Compares an image to a reference. SSIM uses Gaussian windows of the given
+// standard deviation in pixels, which must be positive. As for
+// gaussian_blur_image, sigmas below half a pixel compare single pixels.
+image_metrics compare_images(const image_view<const vec4f>& img,
+    const image_view<const vec4f>& reference, int tile_size = 32,
+    float ssim_sigma = 1.5f);
+
+// Maps errors in [0, max_error] to a blue to red false color image.
+image<vec4f> make_heatmap(
+    const image_view<const float>& errors, float max_error);
+
+}  // namespace yocto::image
+
+// -----------------------------------------------------------------------------
+// BLOCK COMPRESSED IMAGES
+// -----------------------------------------------------------------------------
+namespace yocto::image {
+
+// Block compression formats. Both store 4x4 pixel blocks in 64 bits.
+// `bc1` stores colors as two 565 endpoints and 2-bit indices (6:1 vs vec3b),
+// `bc4` stores scalars as two 8-bit endpoints and 3-bit indices (2:1 vs byte).
+enum struct block_format { bc1, bc4 };
+
+// Block compressed image. Pixels are decoded one at a time on lookup, so
+// these can be used directly as textures.
+struct block_image {
+  block_format          format = block_format::bc1;
+  vec2i                 extent = {0, 0};
+  std::vector<uint64_t> blocks = {};
+
+  bool  empty() const { return blocks.empty(); }
+  vec2i size() const { return extent; }
+};
+
+// Compress color images with bc1 and scalar images with bc4.
+block_image compress_image(const image<vec3b>& img);
+block_image compress_image(const image<byte>& img);
+
+// Decompress a whole image. The format must match the image type.
+void decompress_image(image<vec3b>& img, const block_image& compressed);
+void decompress_image(image<byte>& img, const block_image& compressed);
+
+// Decode a single pixel of bc1 and bc4 images respectively.
+vec3b lookup_color(const block_image& img, const vec2i& ij);
+byte  lookup_scalar(const block_image& img, const vec2i& ij);
 
 }  // namespace yocto::image
 
@@ -296,32 +566,97 @@ bool is_hdr_filename(const std::string& filename);
 // Loads/saves a 4 channels float/byte image in linear/srgb color space.
 bool load_image(
     const std::string& filename, image<vec4f>& img, std::string& error);
-bool save_image(
-    const std::string& filename, const image<vec4f>& img, std::string& error);
+bool save_image(const std::string& filename,
+    const image_view<const vec4f>& img, std::string& error);
 bool load_image(
     const std::string& filename, image<vec4b>& img, std::string& error);
-bool save_image(
-    const std::string& filename, const image<vec4b>& img, std::string& error);
+bool save_image(const std::string& filename,
+    const image_view<const vec4b>& img, std::string& error);
 
 // Loads/saves a 3 channels float/byte image in linear/srgb color space.
 bool load_image(
     const std::string& filename, image<vec3f>& img, std::string& error);
-bool save_image(
-    const std::string& filename, const image<vec3f>& img, std::string& error);
+bool save_image(const std::string& filename,
+    const image_view<const vec3f>& img, std::string& error);
 bool load_image(
     const std::string& filename, image<vec3b>& img, std::string& error);
-bool save_image(
-    const std::string& filename, const image<vec3b>& img, std::string& error);
+bool save_image(const std::string& filename,
+    const image_view<const vec3b>& img, std::string& error);
 
 // Loads/saves a 1 channels float/byte image in linear/srgb color space.
 bool load_image(
     const std::string& filename, image<float>& img, std::string& error);
-bool save_image(
-    const std::string& filename, const image<float>& img, std::string& error);
+bool save_image(const std::string& filename,
+    const image_view<const float>& img, std::string& error);
 bool load_image(
     const std::string& filename, image<byte>& img, std::string& error);
-bool save_image(
-    const std::string& filename, const image<byte>& img, std::string& error);
+bool save_image(const std::string& filename,
+    const image_view<const byte>& img, std::string& error);
+
+// Loads a batch of images in parallel, decoding at most `max_concurrent` files
+// at once to bound memory, or one per core if zero. Errors are reported per
+// file in `errors`, left empty on success, and do not stop the batch.
+// Returns whether all images were loaded.
+bool load_images(const std::vector<std::string>& filenames,
+    std::vector<image<vec4f>>& imgs, std::vector<std::string>& errors,
+    int max_concurrent = 0);
+bool load_images(const std::vector<std::string>& filenames,
+    std::vector<image<vec4b>>& imgs, std::vector<std::string>& errors,
+    int max_concurrent = 0);
+bool load_images(const std::vector<std::string>& filenames,
+    std::vector<image<vec3f>>& imgs, std::vector<std::string>& errors,
+    int max_concurrent = 0);
+bool load_images(const std::vector<std::string>& filenames,
+    std::vector<image<vec3b>>& imgs, std::vector<std::string>& errors,
+    int max_concurrent = 0);
+bool load_images(const std::vector<std::string>& filenames,
+    std::vector<image<float>>& imgs, std::vector<std::string>& errors,
+    int max_concurrent = 0);
+bool load_images(const std::vector<std::string>& filenames,
+    std::vector<image<byte>>& imgs, std::vector<std::string>& errors,
+    int max_concurrent = 0);
+// Runs `load(index, error)` for `count` files with the same policy, for
+// callers that pick the image type per file.
+bool load_images(size_t count,
+    const std::function<bool(size_t index, std::string& error)>& load,
+    std::vector<std::string>& errors, int max_concurrent = 0);
+
+// Compression used when writing EXR images.
+enum struct exr_compression { none, zip, piz };
+
+// Streaming writer for large hdr images in EXR or HDR format. Rows can be
+// written in any order as they are finished, e.g. from a render callback, but
+// each row exactly once. Only partially filled EXR blocks are kept in memory.
+// HDR files ignore compression and half-float settings.
+struct image_writer {
+  std::string                     filename    = "";
+  vec2i                           extent      = {0, 0};
+  exr_compression                 compression = exr_compression::zip;
+  bool                            half        = true;
+  bool                            exr         = true;
+  FILE*                           fs          = nullptr;
+  int                             block_rows  = 1;
+  size_t                          header_size = 0;
+  size_t                          next_offset = 0;
+  std::vector<uint64_t>           offsets     = {};
+  std::vector<int>                filled      = {};
+  std::vector<std::vector<vec4f>> blocks      = {};
+
+  image_writer() = default;
+  image_writer(const image_writer&) = delete;
+  image_writer& operator=(const image_writer&) = delete;
+  ~image_writer();
+};
+
+// Opens a streaming writer for an image of the given size.
+bool open_image_writer(image_writer& writer, const std::string& filename,
+    const vec2i& size, std::string& error,
+    exr_compression compression = exr_compression::zip, bool half = true);
+// Writes full-width rows starting at row `start`.
+bool write_image_rows(image_writer& writer, const image_view<const vec4f>& rows,
+    int start, std::string& error);
+// Finalizes the file. Fails if some rows were never written.
+bool close_image_writer(image_writer& writer, std::string& error);
 
 }  // namespace yocto::image
 
@@ -384,6 +719,32 @@ void make_lights(image<vec4f>& img, const vec2i& size,
     const vec3f& le = {1, 1, 1}, int nlights = 4, float langle = pif / 4,
     float lwidth = pif / 16, float lheight = pif / 16);
 
+// Shader used by procedural images. Maps uv coordinates, normalized by the
+// largest image side as in the generators above, to colors.
+using image_shader = std::function<vec4f(const vec2f& uv)>;
+
+// Procedural image evaluated lazily in tiles at any resolution. Tiles are
+// computed on first access, safely from multiple threads, and then kept.
+struct procedural_image {
+  vec2i                             extent    = {0, 0};
+  int                               tile_size = 64;
+  image_shader                      shader    = {};
+  std::vector<image<vec4f>>         tiles     = {};
+  std::unique_ptr<std::once_flag[]> evaluated = {};
+};
+
+// Make a procedural image from a shader.
+procedural_image make_procedural_image(
+    const vec2i& size, const image_shader& shader, int tile_size = 64);
+// Get a pixel, evaluating its tile if needed.
+vec4f get_pixel(procedural_image& img, const vec2i& ij);
+// Get a region, evaluating the missing tiles in parallel.
+image<vec4f> get_region(
+    procedural_image& img, const vec2i& offset, const vec2i& size);
+// Evaluate a shader over an image in parallel tiles, without caching.
+void make_image(
+    image<vec4f>& img, const vec2i& size, const image_shader& shader);
+
 // Comvert a bump map to a normal map. All linear color spaces.
 image<vec4f> bump_to_normal(const image<vec4f>& img, float scale = 1);
 
@@ -454,6 +815,37 @@ inline bool operator!=(const volume<T>& a, const volume<T>& b);
 template <typename T>
 inline void swap(volume<T>& a, volume<T>& b);
 
+// Sparse volume stored in bricks of 8^3 voxels. Bricks whose voxels all equal
+// the background value are not stored, which saves memory for mostly empty
+// grids and lets lookups skip empty space.
+struct sparse_volume {
+  vec3i                extent     = {0, 0, 0};
+  float                background = 0;
+  std::vector<int64_t> bricks     = {};  // brick offsets in voxels or -1
+  std::vector<float>   voxels     = {};  // voxels of stored bricks
+
+  bool  empty() const { return extent == zero3i; }
+  vec3i size() const { return extent; }
+};
+
+// Size of sparse volume bricks.
+inline constexpr int volume_brick_size = 8;
+
+// Make a sparse volume from a dense one.
+sparse_volume make_sparse_volume(
+    const volume<float>& vol, float background = 0);
+
+// Number of bricks along each axis and total number of stored voxels.
+vec3i  get_bricks(const sparse_volume& vol);
+size_t count_voxels(const sparse_volume& vol);
+
+// Downsample a volume by 2 along each axis, averaging 2^3 voxels.
+volume<float> downsample_volume(const volume<float>& vol);
+
+// Make a mip chain for level of detail queries. The first level is the
+// volume itself and the last has a single voxel.
+std::vector<volume<float>> make_volume_mips(const volume<float>& vol);
+
 }  // namespace yocto::image
 
 // -----------------------------------------------------------------------------
@@ -461,9 +853,30 @@ inline void swap(volume<T>& a, volume<T>& b);
 // -----------------------------------------------------------------------------
 namespace yocto::image {
 
-// Evaluates a color image at a point `uv`.
-float eval_volume(const image<float>& img, const vec3f& uvw,
-    bool no_interpolation = false, bool clamp_to_edge = false);
+// Lookup a volume voxel.
+float lookup_volume(const volume<float>& vol, const vec3i& ijk);
+float lookup_volume(const sparse_volume& vol, const vec3i& ijk);
+
+// Evaluates a volume at a point `uvw` in [-1,1]^3. Lookups clamp to the
+// volume edges by default; pass `clamp_to_edge = false` to wrap around.
+// Sparse volumes return the background directly when the lookup falls
+// within an empty brick.
+float eval_volume(const volume<float>& vol, const vec3f& uvw,
+    bool no_interpolation = false, bool clamp_to_edge = true);
+float eval_volume(const sparse_volume& vol, const vec3f& uvw,
+    bool no_interpolation = false, bool clamp_to_edge = true);
+
+// Evaluates a volume at `count` points, writing the results to `values`.
+// Large batches are evaluated in parallel.
+void eval_volume(float* values, const volume<float>& vol, const vec3f* uvw,
+    size_t count, bool no_interpolation = false, bool clamp_to_edge = true);
+void eval_volume(float* values, const sparse_volume& vol, const vec3f* uvw,
+    size_t count, bool no_interpolation = false, bool clamp_to_edge = true);
+
+// Evaluates a volume mip chain at a fractional level of detail, blending
+// the two nearest levels.
+float eval_volume(const std::vector<volume<float>>& mips, const vec3f& uvw,
+    float level, bool no_interpolation = false, bool clamp_to_edge = true);
 
 }  // namespace yocto::image
 
@@ -472,9 +885,15 @@ float eval_volume(const image<float>& img, const vec3f& uvw,
 // -----------------------------------------------------------------------------
 namespace yocto::image {
 
-// Loads/saves a 1 channel volume.
-void load_volume(const std::string& filename, volume<float>& vol);
-void save_volume(const std::string& filename, const volume<float>& vol);
+// Loads/saves a 1 channel volume. Files are memory mapped when loading.
+// Sparse volumes are bricked directly from the mapped file, so the dense
+// grid is never held in memory.
+bool load_volume(
+    const std::string& filename, volume<float>& vol, std::string& error);
+bool load_volume(const std::string& filename, sparse_volume& vol,
+    std::string& error, float background = 0);
+bool save_volume(
+    const std::string& filename, const volume<float>& vol, std::string& error);
 
 }  // namespace yocto::image
 
@@ -534,6 +953,42 @@ vec3f xyz_to_color(const vec3f& xyz, color_space to);
 // -----------------------------------------------------------------------------
 namespace yocto::image {
 
+// Image allocator ----------
+
+// allocation
+template <typename T>
+inline T* image_allocator<T>::allocate(size_t n) {
+  return (T*)impl::allocate_image_buffer(n * sizeof(T));
+}
+template <typename T>
+inline void image_allocator<T>::deallocate(T* buffer, size_t n) {
+  impl::free_image_buffer(buffer, n * sizeof(T));
+}
+
+// construction
+template <typename T>
+template <typename U>
+inline void image_allocator<T>::construct(U* ptr) {
+  if constexpr (!std::is_trivially_copyable_v<U>) ::new ((void*)ptr) U;
+}
+template <typename T>
+template <typename U, typename... Args>
+inline void image_allocator<T>::construct(U* ptr, Args&&... args) {
+  ::new ((void*)ptr) U(std::forward<Args>(args)...);
+}
+
+// allocators are stateless
+template <typename T, typename U>
+inline bool operator==(const image_allocator<T>&, const image_allocator<U>&) {
+  return true;
+}
+template <typename T, typename U>
+inline bool operator!=(const image_allocator<T>&, const image_allocator<U>&) {
+  return false;
+}
+
+// Image container ----------
+
 // constructors
 template <typename T>
 inline image<T>::image() : extent{0, 0}, pixels{} {}
@@ -543,6 +998,9 @@ inline image<T>::image(const vec2i& size, const T& value)
 template <typename T>
 inline image<T>::image(const vec2i& size, const T* value)
     : extent{size}, pixels(value, value + (size_t)size.x * (size_t)size.y) {}
+template <typename T>
+inline image<T>::image(const vec2i& size, uninit_t)
+    : extent{size}, pixels((size_t)size.x * (size_t)size.y) {}
 
 // size
 template <typename T>
@@ -563,6 +1021,12 @@ inline bool image<T>::contains(const vec2i& ij) const {
 }
 template <typename T>
 inline void image<T>::resize(const vec2i& size) {
+  if (size == extent) return;
+  extent = size;
+  pixels.resize((size_t)size.x * (size_t)size.y, T{});
+}
+template <typename T>
+inline void image<T>::resize(const vec2i& size, uninit_t) {
   if (size == extent) return;
   extent = size;
   pixels.resize((size_t)size.x * (size_t)size.y);
@@ -644,6 +1108,111 @@ inline void swap(image<T>& a, image<T>& b) {
   a.swap(b);
 }
 
+// Image view ----------
+
+// constructors
+template <typename T>
+inline image_view<T>::image_view() : pixels{nullptr}, extent{0, 0}, pitch{0} {}
+template <typename T>
+inline image_view<T>::image_view(T* data, const vec2i& size)
+    : pixels{data}, extent{size}, pitch{(size_t)size.x} {}
+template <typename T>
+inline image_view<T>::image_view(T* data, const vec2i& size, size_t stride)
+    : pixels{data}, extent{size}, pitch{stride} {}
+template <typename T>
+template <typename U, typename>
+inline image_view<T>::image_view(image<U>& img)
+    : pixels{img.data()}, extent{img.size()}, pitch{(size_t)img.size().x} {}
+template <typename T>
+template <typename U, typename>
+inline image_view<T>::image_view(const image<U>& img)
+    : pixels{img.data()}, extent{img.size()}, pitch{(size_t)img.size().x} {}
+template <typename T>
+template <typename U, typename>
+inline image_view<T>::image_view(const image_view<U>& view)
+    : pixels{view.data()}, extent{view.size()}, pitch{view.stride()} {}
+
+// size
+template <typename T>
+inline bool image_view<T>::empty() const {
+  return extent.x <= 0 || extent.y <= 0;
+}
+template <typename T>
+inline vec2i image_view<T>::size() const {
+  return extent;
+}
+template <typename T>
+inline size_t image_view<T>::count() const {
+  return empty() ? 0 : (size_t)extent.x * (size_t)extent.y;
+}
+template <typename T>
+inline size_t image_view<T>::stride() const {
+  return pitch;
+}
+template <typename T>
+inline bool image_view<T>::contiguous() const {
+  return pitch == (size_t)extent.x || extent.y <= 1;
+}
+template <typename T>
+inline bool image_view<T>::contains(const vec2i& ij) const {
+  return ij.x >= 0 && ij.x < extent.x && ij.y >= 0 && ij.y < extent.y;
+}
+
+// element access
+template <typename T>
+inline T& image_view<T>::operator[](const vec2i& ij) const {
+  return pixels[(size_t)ij.y * pitch + (size_t)ij.x];
+}
+
+// data access
+template <typename T>
+inline T* image_view<T>::data() const {
+  return pixels;
+}
+template <typename T>
+inline T* image_view<T>::row(int j) const {
+  return pixels + (size_t)j * pitch;
+}
+
+// Views of a region of an image.
+template <typename T>
+inline image_view<T> get_view(
+    const image_view<T>& view, const vec2i& offset, const vec2i& size) {
+  auto start = math::min(math::max(offset, zero2i), view.size());
+  auto end   = math::min(math::max(offset + size, start), view.size());
+  return {view.data() + (size_t)start.y * view.stride() + (size_t)start.x,
+      end - start, view.stride()};
+}
+template <typename T>
+inline image_view<T> get_view(
+    image<T>& img, const vec2i& offset, const vec2i& size) {
+  return get_view(image_view<T>{img}, offset, size);
+}
+template <typename T>
+inline image_view<const T> get_view(
+    const image<T>& img, const vec2i& offset, const vec2i& size) {
+  return get_view(image_view<const T>{img}, offset, size);
+}
+
+// Copy a view into an owning image.
+template <typename T>
+inline image<std::remove_const_t<T>> copy_image(const image_view<T>& view) {
+  auto img = image<std::remove_const_t<T>>{view.size(), uninit};
+  copy_pixels(image_view<std::remove_const_t<T>>{img},
+      image_view<const std::remove_const_t<T>>{view});
+  return img;
+}
+// Copy pixels between views of the same size.
+template <typename T>
+inline void copy_pixels(
+    const image_view<T>& dst, const image_view<const T>& src) {
+  if (dst.size() != src.size())
+    throw std::invalid_argument("views have different sizes");
+  for (auto j = 0; j < src.size().y; j++) {
+    std::copy(src.row(j), src.row(j) + src.size().x, dst.row(j));
+  }
+}
+
 }  // namespace yocto::image
 
 // -----------------------------------------------------------------------------
@@ -180,6 +180,10 @@
 #include <limits>
 #include <vector>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 // -----------------------------------------------------------------------------
 // MATH CONSTANTS AND FUNCTIONS
 // -----------------------------------------------------------------------------
@@ -1446,6 +1450,22 @@ inline float perlin_fbm(const vec3f& p, float lacunarity = 2, float gain = 0.5,
 inline float perlin_turbulence(const vec3f& p, float lacunarity = 2,
     float gain = 0.5, int octaves = 6, const vec3i& wrap = zero3i);
 
+// Batched Perlin noise. Evaluates `count` points, writing results to `noise`.
+// Points are processed 8 at a time, with octaves accumulated in place for
+// each batch. Uses AVX2 when compiled with it, and scalar code otherwise.
+// Results match the single point functions above.
+inline void perlin_noise(float* noise, const vec3f* points, size_t count,
+    const vec3i& wrap = zero3i);
+inline void perlin_ridge(float* noise, const vec3f* points, size_t count,
+    float lacunarity = 2, float gain = 0.5, int octaves = 6, float offset = 1,
+    const vec3i& wrap = zero3i);
+inline void perlin_fbm(float* noise, const vec3f* points, size_t count,
+    float lacunarity = 2, float gain = 0.5, int octaves = 6,
+    const vec3i& wrap = zero3i);
+inline void perlin_turbulence(float* noise, const vec3f* points, size_t count,
+    float lacunarity = 2, float gain = 0.5, int octaves = 6,
+    const vec3i& wrap = zero3i);
+
 }  // namespace yocto::math
 
 // -----------------------------------------------------------------------------
@@ -3756,51 +3776,49 @@ inline int _stb__perlin_fastfloor(float a)
     return (a < ai) ? ai-1 : ai;
 }
 
+inline constexpr float _stb__perlin_basis[12][4] =
+{
+   {  1, 1, 0 },
+   { -1, 1, 0 },
+   {  1,-1, 0 },
+   { -1,-1, 0 },
+   {  1, 0, 1 },
+   { -1, 0, 1 },
+   {  1, 0,-1 },
+   { -1, 0,-1 },
+   {  0, 1, 1 },
+   {  0,-1, 1 },
+   {  0, 1,-1 },
+   {  0,-1,-1 },
+};
+
+// perlin's gradient has 12 cases so some get used 1/16th of the time
+// and some 2/16ths. We reduce bias by changing those fractions
+// to 5/64ths and 6/64ths, and the same 4 cases get the extra weight.
+inline constexpr unsigned char _stb__perlin_indices[64] =
+{
+   0,1,2,3,4,5,6,7,8,9,10,11,
+   0,9,1,11,
+   0,1,2,3,4,5,6,7,8,9,10,11,
+   0,1,2,3,4,5,6,7,8,9,10,11,
+   0,1,2,3,4,5,6,7,8,9,10,11,
+   0,1,2,3,4,5,6,7,8,9,10,11,
+};
+
 // different grad function from Perlin's, but easy to modify to match reference
 inline float _stb__perlin_grad(int hash, float x, float y, float z)
 {
-   static float basis[12][4] =
-   {
-      {  1, 1, 0 },
-      { -1, 1, 0 },
-      {  1,-1, 0 },
-      { -1,-1, 0 },
-      {  1, 0, 1 },
-      { -1, 0, 1 },
-      {  1, 0,-1 },
-      { -1, 0,-1 },
-      {  0, 1, 1 },
-      {  0,-1, 1 },
-      {  0, 1,-1 },
-      {  0,-1,-1 },
-   };
-
-   // perlin's gradient has 12 cases so some get used 1/16th of the time
-   // and some 2/16ths. We reduce bias by changing those fractions
-   // to 5/64ths and 6/64ths, and the same 4 cases get the extra weight.
-   static unsigned char indices[64] =
-   {
-      0,1,2,3,4,5,6,7,8,9,10,11,
-      0,9,1,11,
-      0,1,2,3,4,5,6,7,8,9,10,11,
-      0,1,2,3,4,5,6,7,8,9,10,11,
-      0,1,2,3,4,5,6,7,8,9,10,11,
-      0,1,2,3,4,5,6,7,8,9,10,11,
-   };
-
    // if you use reference permutation table, change 63 below to 15 to match reference
    // (this is why the ordering of the table above is funky)
-   float *grad = basis[indices[hash & 63]];
+   const float *grad = _stb__perlin_basis[_stb__perlin_indices[hash & 63]];
    return grad[0]*x + grad[1]*y + grad[2]*z;
 }
 
-inline float _stb_perlin_noise3(float x, float y, float z, int x_wrap, int y_wrap, int z_wrap)
+// not same permutation table as Perlin's reference to avoid copyright issues;
+// Perlin's table can be found at http://mrl.nyu.edu/~perlin/noise/
+// @OPTIMIZE: should this be unsigned char instead of int for cache?
+inline constexpr unsigned char _stb__perlin_randtab[512] =
 {
-    // not same permutation table as Perlin's reference to avoid copyright issues;
-    // Perlin's table can be found at http://mrl.nyu.edu/~perlin/noise/
-    // @OPTIMIZE: should this be unsigned char instead of int for cache?
-    static unsigned char _stb__perlin_randtab[512] =
-    {
     23, 125, 161, 52, 103, 117, 70, 37, 247, 101, 203, 169, 124, 126, 44, 123,
     152, 238, 145, 45, 171, 114, 253, 10, 192, 136, 4, 157, 249, 30, 35, 72,
     175, 63, 77, 90, 181, 16, 96, 111, 133, 104, 75, 162, 93, 56, 66, 240,
@@ -3835,8 +3853,10 @@ inline float _stb_perlin_noise3(float x, float y, float z, int x_wrap, int y_wra
     131, 11, 163, 99, 234, 81, 227, 147, 156, 176, 17, 142, 69, 12, 110, 62,
     27, 255, 0, 194, 59, 116, 242, 252, 19, 21, 187, 53, 207, 129, 64, 135,
     61, 40, 167, 237, 102, 223, 106, 159, 197, 189, 215, 137, 36, 32, 22, 5,
-    };
+};
 
+inline float _stb_perlin_noise3(float x, float y, float z, int x_wrap, int y_wrap, int z_wrap)
+{
    float u,v,w;
    float n000,n001,n010,n011,n100,n101,n110,n111;
    float n00,n01,n10,n11;
@@ -3967,6 +3987,215 @@ inline float perlin_turbulence(const vec3f& p, float lacunarity, float gain,
       p.x, p.y, p.z, lacunarity, gain, octaves, wrap.x, wrap.y, wrap.z);
 }
 
+// Points of a noise batch stored as structure of arrays
+struct _perlin_lanes {
+  float x[8] = {}, y[8] = {}, z[8] = {};
+};
+
+#ifdef __AVX2__
+
+// Permutation table widened to 32 bits and gradient components indexed
+// directly by `hash & 63`, for use with gathers.
+inline constexpr auto _perlin_randtab32 = [] {
+  auto table = std::array<int, 512>{};
+  for (auto idx = 0; idx < 512; idx++) table[idx] = _stb__perlin_randtab[idx];
+  return table;
+}();
+inline constexpr auto _perlin_gradients = [] {
+  auto gradients = std::array<std::array<float, 64>, 3>{};
+  for (auto hash = 0; hash < 64; hash++) {
+    for (auto c = 0; c < 3; c++) {
+      gradients[c][hash] = _stb__perlin_basis[_stb__perlin_indices[hash]][c];
+    }
+  }
+  return gradients;
+}();
+
+// Evaluates Perlin noise at 8 points scaled by frequency with AVX2.
+// Follows `_stb_perlin_noise3()` operation by operation.
+inline void _perlin_noise8(float* noise, const _perlin_lanes& lanes,
+    float frequency, const vec3i& wrap) {
+  auto ease = [](__m256 a) {
+    auto e = _mm256_sub_ps(
+        _mm256_mul_ps(a, _mm256_set1_ps(6)), _mm256_set1_ps(15));
+    e = _mm256_add_ps(_mm256_mul_ps(e, a), _mm256_set1_ps(10));
+    return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(e, a), a), a);
+  };
+  auto lerp = [](__m256 a, __m256 b, __m256 t) {
+    return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), t));
+  };
+  auto hash = [](__m256i idx) {
+    return _mm256_i32gather_epi32(_perlin_randtab32.data(), idx, 4);
+  };
+  auto grad = [](__m256i hash, __m256 x, __m256 y, __m256 z) {
+    auto h  = _mm256_and_si256(hash, _mm256_set1_epi32(63));
+    auto gx = _mm256_i32gather_ps(_perlin_gradients[0].data(), h, 4);
+    auto gy = _mm256_i32gather_ps(_perlin_gradients[1].data(), h, 4);
+    auto gz = _mm256_i32gather_ps(_perlin_gradients[2].data(), h, 4);
+    return _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(gx, x), _mm256_mul_ps(gy, y)),
+        _mm256_mul_ps(gz, z));
+  };
+
+  auto scale = _mm256_set1_ps(frequency);
+  auto x     = _mm256_mul_ps(_mm256_loadu_ps(lanes.x), scale);
+  auto y     = _mm256_mul_ps(_mm256_loadu_ps(lanes.y), scale);
+  auto z     = _mm256_mul_ps(_mm256_loadu_ps(lanes.z), scale);
+  auto fx    = _mm256_floor_ps(x);
+  auto fy    = _mm256_floor_ps(y);
+  auto fz    = _mm256_floor_ps(z);
+  auto px    = _mm256_cvtps_epi32(fx);
+  auto py    = _mm256_cvtps_epi32(fy);
+  auto pz    = _mm256_cvtps_epi32(fz);
+  auto one   = _mm256_set1_epi32(1);
+  auto xmask = _mm256_set1_epi32((wrap.x - 1) & 255);
+  auto ymask = _mm256_set1_epi32((wrap.y - 1) & 255);
+  auto zmask = _mm256_set1_epi32((wrap.z - 1) & 255);
+  auto x0    = _mm256_and_si256(px, xmask);
+  auto x1    = _mm256_and_si256(_mm256_add_epi32(px, one), xmask);
+  auto y0    = _mm256_and_si256(py, ymask);
+  auto y1    = _mm256_and_si256(_mm256_add_epi32(py, one), ymask);
+  auto z0    = _mm256_and_si256(pz, zmask);
+  auto z1    = _mm256_and_si256(_mm256_add_epi32(pz, one), zmask);
+
+  x       = _mm256_sub_ps(x, fx);
+  y       = _mm256_sub_ps(y, fy);
+  z       = _mm256_sub_ps(z, fz);
+  auto u  = ease(x);
+  auto v  = ease(y);
+  auto w  = ease(z);
+  auto xm = _mm256_sub_ps(x, _mm256_set1_ps(1));
+  auto ym = _mm256_sub_ps(y, _mm256_set1_ps(1));
+  auto zm = _mm256_sub_ps(z, _mm256_set1_ps(1));
+
+  auto r0  = hash(x0);
+  auto r1  = hash(x1);
+  auto r00 = hash(_mm256_add_epi32(r0, y0));
+  auto r01 = hash(_mm256_add_epi32(r0, y1));
+  auto r10 = hash(_mm256_add_epi32(r1, y0));
+  auto r11 = hash(_mm256_add_epi32(r1, y1));
+
+  auto n000 = grad(hash(_mm256_add_epi32(r00, z0)), x, y, z);
+  auto n001 = grad(hash(_mm256_add_epi32(r00, z1)), x, y, zm);
+  auto n010 = grad(hash(_mm256_add_epi32(r01, z0)), x, ym, z);
+  auto n011 = grad(hash(_mm256_add_epi32(r01, z1)), x, ym, zm);
+  auto n100 = grad(hash(_mm256_add_epi32(r10, z0)), xm, y, z);
+  auto n101 = grad(hash(_mm256_add_epi32(r10, z1)), xm, y, zm);
+  auto n110 = grad(hash(_mm256_add_epi32(r11, z0)), xm, ym, z);
+  auto n111 = grad(hash(_mm256_add_epi32(r11, z1)), xm, ym, zm);
+
+  auto n00 = lerp(n000, n001, w);
+  auto n01 = lerp(n010, n011, w);
+  auto n10 = lerp(n100, n101, w);
+  auto n11 = lerp(n110, n111, w);
+  auto n0  = lerp(n00, n01, v);
+  auto n1  = lerp(n10, n11, v);
+  _mm256_storeu_ps(noise, lerp(n0, n1, u));
+}
+
+#else
+
+// Evaluates Perlin noise at 8 points scaled by frequency.
+inline void _perlin_noise8(float* noise, const _perlin_lanes& lanes,
+    float frequency, const vec3i& wrap) {
+  for (auto lane = 0; lane < 8; lane++) {
+    noise[lane] = _stb_perlin_noise3(lanes.x[lane] * frequency,
+        lanes.y[lane] * frequency, lanes.z[lane] * frequency, wrap.x, wrap.y,
+        wrap.z);
+  }
+}
+
+#endif
+
+// Splits points in batches of 8 lanes, zero padding the last one, and
+// calls `func(sum, lanes)` to accumulate the noise of each batch.
+template <typename Func>
+inline void _perlin_batches(
+    float* noise, const vec3f* points, size_t count, Func&& func) {
+  for (auto start = (size_t)0; start < count; start += 8) {
+    auto num   = std::min(count - start, (size_t)8);
+    auto lanes = _perlin_lanes{};
+    for (auto lane = (size_t)0; lane < num; lane++) {
+      lanes.x[lane] = points[start + lane].x;
+      lanes.y[lane] = points[start + lane].y;
+      lanes.z[lane] = points[start + lane].z;
+    }
+    float sum[8] = {};
+    func(sum, lanes);
+    for (auto lane = (size_t)0; lane < num; lane++) {
+      noise[start + lane] = sum[lane];
+    }
+  }
+}
+
+// Batched Perlin noise
+inline void perlin_noise(
+    float* noise, const vec3f* points, size_t count, const vec3i& wrap) {
+  _perlin_batches(noise, points, count,
+      [&](float* sum, const _perlin_lanes& lanes) {
+        _perlin_noise8(sum, lanes, 1, wrap);
+      });
+}
+
+// Batched ridge noise
+inline void perlin_ridge(float* noise, const vec3f* points, size_t count,
+    float lacunarity, float gain, int octaves, float offset,
+    const vec3i& wrap) {
+  _perlin_batches(noise, points, count,
+      [&](float* sum, const _perlin_lanes& lanes) {
+        auto  frequency = 1.0f, amplitude = 0.5f;
+        float prev[8] = {1, 1, 1, 1, 1, 1, 1, 1}, octave[8];
+        for (auto idx = 0; idx < octaves; idx++) {
+          _perlin_noise8(octave, lanes, frequency, wrap);
+          for (auto lane = 0; lane < 8; lane++) {
+            auto r = offset - std::abs(octave[lane]);
+            r      = r * r;
+            sum[lane] += r * amplitude * prev[lane];
+            prev[lane] = r;
+          }
+          frequency *= lacunarity;
+          amplitude *= gain;
+        }
+      });
+}
+
+// Batched fractal noise
+inline void perlin_fbm(float* noise, const vec3f* points, size_t count,
+    float lacunarity, float gain, int octaves, const vec3i& wrap) {
+  _perlin_batches(noise, points, count,
+      [&](float* sum, const _perlin_lanes& lanes) {
+        auto  frequency = 1.0f, amplitude = 1.0f;
+        float octave[8];
+        for (auto idx = 0; idx < octaves; idx++) {
+          _perlin_noise8(octave, lanes, frequency, wrap);
+          for (auto lane = 0; lane < 8; lane++) {
+            sum[lane] += octave[lane] * amplitude;
+          }
+          frequency *= lacunarity;
+          amplitude *= gain;
+        }
+      });
+}
+
+// Batched turbulence noise
+inline void perlin_turbulence(float* noise, const vec3f* points,
+    size_t count, float lacunarity, float gain, int octaves,
+    const vec3i& wrap) {
+  _perlin_batches(noise, points, count,
+      [&](float* sum, const _perlin_lanes& lanes) {
+        auto  frequency = 1.0f, amplitude = 1.0f;
+        float octave[8];
+        for (auto idx = 0; idx < octaves; idx++) {
+          _perlin_noise8(octave, lanes, frequency, wrap);
+          for (auto lane = 0; lane < 8; lane++) {
+            sum[lane] += std::abs(octave[lane] * amplitude);
+          }
+          frequency *= lacunarity;
+          amplitude *= gain;
+        }
+      });
+}
+
 }  // namespace yocto::math
 
 // -----------------------------------------------------------------------------
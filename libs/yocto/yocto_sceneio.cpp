@@ -47,6 +47,7 @@
 #include <deque>
 #include <future>
 #include <memory>
+#include <mutex>
 
 #include "ext/filesystem.hpp"
 #include "ext/json.hpp"
@@ -1366,23 +1367,47 @@ static bool load_json_scene(const std::string& filename, scn::model* scene,
             subdiv->texcoords, error))
       return dependent_error();
   }
-  // load textures
+  // load textures in parallel
   ctexture_map.erase("");
+  stexture_map.erase("");
+  auto textures = std::vector<std::pair<std::string, scn::texture*>>{};
+  auto scalars  = std::vector<bool>{};
   for (auto [name, texture] : ctexture_map) {
-    if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
-    auto path = get_filename(
-        name, "textures", {".hdr", ".exr", ".png", ".jpg"});
-    if (!load_image(path, texture->colorf, texture->colorb, error))
-      return dependent_error();
+    textures.push_back({get_filename(name, "textures",
+                            {".hdr", ".exr", ".png", ".jpg"}),
+        texture});
+    scalars.push_back(false);
   }
-  // load textures
-  stexture_map.erase("");
   for (auto [name, texture] : stexture_map) {
-    if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
-    auto path = get_filename(
-        name, "textures", {".hdr", ".exr", ".png", ".jpg"});
-    if (!load_image(path, texture->scalarf, texture->scalarb, error))
-      return dependent_error();
+    textures.push_back({get_filename(name, "textures",
+                            {".hdr", ".exr", ".png", ".jpg"}),
+        texture});
+    scalars.push_back(true);
+  }
+  auto progress_mutex = std::mutex{};
+  auto texture_errors = std::vector<std::string>{};
+  if (!img::load_images(
+          textures.size(),
+          [&](size_t idx, std::string& error) {
+            auto [path, texture] = textures[idx];
+            auto ok = scalars[idx] ? load_image(path, texture->scalarf,
+                                         texture->scalarb, error)
+                                   : load_image(path, texture->colorf,
+                                         texture->colorb, error);
+            if (progress_cb) {
+              auto lock = std::lock_guard{progress_mutex};
+              progress_cb("load texture", progress.x++, progress.y);
+            }
+            return ok;
+          },
+          texture_errors, noparallel ? 1 : 0)) {
+    error = "cannot load textures";
+    for (auto& texture_error : texture_errors) {
+      if (texture_error.empty()) continue;
+      error = texture_error;
+      break;
+    }
+    return dependent_error();
   }
   // load instances
   instance_map.erase("");
@@ -28,8 +28,13 @@
 
 #include "yocto_trace.h"
 
+#include <algorithm>
 #include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <deque>
+#include <exception>
 #include <future>
 #include <memory>
 #include <mutex>
@@ -39,6 +44,10 @@ using namespace std::string_literals;
 #include <embree3/rtcore.h>
 #endif
 
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
 // -----------------------------------------------------------------------------
 // ALIASES
 // -----------------------------------------------------------------------------
@@ -401,6 +410,10 @@ static vec2i texture_size(const trc::texture* texture) {
     return texture->scalarf.size();
   } else if (!texture->scalarb.empty()) {
     return texture->scalarb.size();
+  } else if (!texture->colorc.empty()) {
+    return texture->colorc.size();
+  } else if (!texture->scalarc.empty()) {
+    return texture->scalarc.size();
   } else {
     return zero2i;
   }
@@ -420,6 +433,14 @@ static vec3f lookup_texture(
     return ldr_as_linear
                ? byte_to_float(vec3b{texture->scalarb[ij]})
                : srgb_to_rgb(byte_to_float(vec3b{texture->scalarb[ij]}));
+  } else if (!texture->colorc.empty()) {
+    auto color = img::lookup_color(texture->colorc, ij);
+    return ldr_as_linear ? byte_to_float(color)
+                         : srgb_to_rgb(byte_to_float(color));
+  } else if (!texture->scalarc.empty()) {
+    auto scalar = vec3b{img::lookup_scalar(texture->scalarc, ij)};
+    return ldr_as_linear ? byte_to_float(scalar)
+                         : srgb_to_rgb(byte_to_float(scalar));
   } else {
     return {1, 1, 1};
   }
@@ -594,10 +615,10 @@ struct trace_point {
 static trace_point eval_point(const trc::scene* scene,
     const intersection3f& intersection, const ray3f& ray) {
   // get data
-  auto object   = scene->objects[intersection.object];
-  auto shape    = object->shape;
-  auto material = object->material;
-  auto frame = object->instance->frames[intersection.instance] * object->frame;
+  auto object           = scene->objects[intersection.object];
+  auto shape            = object->shape;
+  auto material         = object->material;
+  auto frame            = object->transforms[intersection.instance].frame;
   auto element          = intersection.element;
   auto uv               = intersection.uv;
   auto non_rigid_frames = true;
@@ -754,6 +775,29 @@ struct volume_point {
   float volanisotropy = 0;
 };
 
+// Stack with a fixed capacity, to keep the path loop free of allocations.
+// Callers must not push on a full stack or pop an empty one.
+template <typename T, int N>
+struct fixed_stack {
+  T   data[N];
+  int count = 0;
+
+  bool     empty() const { return count == 0; }
+  T&       back() { return data[count - 1]; }
+  const T& back() const { return data[count - 1]; }
+  void     push_back(const T& value) {
+    assert(count < N && "fixed_stack overflow");
+    data[count++] = value;
+  }
+  void pop_back() {
+    assert(count > 0 && "fixed_stack underflow");
+    count--;
+  }
+};
+
+// Maximum number of nested volumes tracked along a path.
+const int max_volumes = 4;
+
 // Evaluate point
 static volume_point eval_volume(const trc::scene* scene,
     const intersection3f& intersection, const ray3f& ray) {
@@ -761,9 +805,9 @@ static volume_point eval_volume(const trc::scene* scene,
   auto& object   = scene->objects[intersection.object];
   auto& shape    = object->shape;
   auto& material = object->material;
-  auto  frame = object->instance->frames[intersection.instance] * object->frame;
-  auto  element = intersection.element;
-  auto  uv      = intersection.uv;
+  auto  frame    = object->transforms[intersection.instance].frame;
+  auto  element  = intersection.element;
+  auto  uv       = intersection.uv;
 
   // initialize point
   auto point     = volume_point{};
@@ -1057,6 +1101,30 @@ static bool intersect_scene_embree_bvh(const trc::scene* scene,
 }
 #endif
 
+// Simple parallel loop over indices, processed in batches that threads
+// grab as they become idle. Runs serially for loops that fit in a single
+// batch or if `parallel` is false.
+template <typename Func>
+static void parallel_for_batch(int num, int batch, bool parallel, Func&& func) {
+  if (!parallel || num <= batch) {
+    for (auto idx = 0; idx < num; idx++) func(idx);
+    return;
+  }
+  auto             futures  = std::vector<std::future<void>>{};
+  auto             nthreads = std::thread::hardware_concurrency();
+  std::atomic<int> next_idx(0);
+  for (auto thread_id = 0; thread_id < nthreads; thread_id++) {
+    futures.emplace_back(std::async(std::launch::async, [&] {
+      while (true) {
+        auto start = next_idx.fetch_add(batch);
+        if (start >= num) break;
+        for (auto idx = start; idx < min(start + batch, num); idx++) func(idx);
+      }
+    }));
+  }
+  for (auto& f : futures) f.get();
+}
+
 // primitive used to sort bvh entries
 struct bvh_primitive {
   bbox3f bbox      = invalidb3f;
@@ -1065,6 +1133,8 @@ struct bvh_primitive {
 };
 
 // Splits a BVH node using the SAH heuristic. Returns split position and axis.
+// Primitives are binned along all axes in a single sweep, and the cost of
+// all bin boundaries is then evaluated from prefix and suffix bounds.
 static std::pair<int, int> split_sah(
     std::vector<bvh_primitive>& primitives, int start, int end) {
   // initialize split axis and position
@@ -1077,50 +1147,70 @@ static std::pair<int, int> split_sah(
   auto csize = cbbox.max - cbbox.min;
   if (csize == zero3f) return {mid, split_axis};
 
-  // consider N bins, compute their cost and keep the minimum
-  const int nbins    = 16;
-  auto      middle   = 0.0f;
-  auto      min_cost = flt_max;
-  auto      area     = [](auto& b) {
+  // bin primitives along each axis
+  const int nbins = 16;
+  auto      bin   = [&cbbox, &csize](const vec3f& center, int axis) {
+    auto offset = (center[axis] - cbbox.min[axis]) / csize[axis];
+    return clamp((int)(offset * nbins), 0, nbins - 1);
+  };
+  auto bins_bbox  = std::array<std::array<bbox3f, nbins>, 3>{};
+  auto bins_count = std::array<std::array<int, nbins>, 3>{};
+  for (auto i = start; i < end; i++) {
+    for (auto axis = 0; axis < 3; axis++) {
+      if (csize[axis] == 0) continue;
+      auto b = bin(primitives[i].center, axis);
+      bins_bbox[axis][b] = merge(bins_bbox[axis][b], primitives[i].bbox);
+      bins_count[axis][b] += 1;
+    }
+  }
+
+  // consider all bin boundaries, compute their cost and keep the minimum
+  auto split_bin = 0;
+  auto min_cost  = flt_max;
+  auto area      = [](auto& b) {
     auto size = b.max - b.min;
     return 1e-12f + 2 * size.x * size.y + 2 * size.x * size.z +
            2 * size.y * size.z;
   };
-  for (auto saxis = 0; saxis < 3; saxis++) {
+  for (auto axis = 0; axis < 3; axis++) {
+    if (csize[axis] == 0) continue;
+    auto right_cost = std::array<float, nbins>{};
+    auto right_bbox = invalidb3f;
+    auto right_num  = 0;
+    for (auto b = nbins - 1; b > 0; b--) {
+      right_bbox    = merge(right_bbox, bins_bbox[axis][b]);
+      right_num     += bins_count[axis][b];
+      right_cost[b] = right_num ? right_num * area(right_bbox) : 0;
+    }
+    auto left_bbox = invalidb3f;
+    auto left_num  = 0;
     for (auto b = 1; b < nbins; b++) {
-      auto split     = cbbox.min[saxis] + b * csize[saxis] / nbins;
-      auto left_bbox = invalidb3f, right_bbox = invalidb3f;
-      auto left_nprims = 0, right_nprims = 0;
-      for (auto i = start; i < end; i++) {
-        if (primitives[i].center[saxis] < split) {
-          left_bbox = merge(left_bbox, primitives[i].bbox);
-          left_nprims += 1;
-        } else {
-          right_bbox = merge(right_bbox, primitives[i].bbox);
-          right_nprims += 1;
-        }
-      }
-      auto cost = 1 + left_nprims * area(left_bbox) / area(cbbox) +
-                  right_nprims * area(right_bbox) / area(cbbox);
+      left_bbox = merge(left_bbox, bins_bbox[axis][b - 1]);
+      left_num += bins_count[axis][b - 1];
+      auto left_cost = left_num ? left_num * area(left_bbox) : 0;
+      auto cost      = 1 + (left_cost + right_cost[b]) / area(cbbox);
       if (cost < min_cost) {
         min_cost   = cost;
-        middle     = split;
-        split_axis = saxis;
+        split_bin  = b;
+        split_axis = axis;
       }
     }
   }
+
   // split
   mid = (int)(std::partition(primitives.data() + start, primitives.data() + end,
-                  [split_axis, middle](auto& primitive) {
-                    return primitive.center[split_axis] < middle;
+                  [&bin, split_axis, split_bin](auto& primitive) {
+                    return bin(primitive.center, split_axis) < split_bin;
                   }) -
               primitives.data());
 
   // if we were not able to split, just break the primitives in half
   if (mid == start || mid == end) {
-    throw std::runtime_error("bad bvh split");
-    split_axis = 0;
-    mid        = (start + end) / 2;
+    mid = (start + end) / 2;
+    std::nth_element(primitives.data() + start, primitives.data() + mid,
+        primitives.data() + end, [split_axis](auto& a, auto& b) {
+          return a.center[split_axis] < b.center[split_axis];
+        });
   }
 
   return {mid, split_axis};
@@ -1205,6 +1295,8 @@ static std::pair<int, int> split_nodes(
     case bvh_type::highquality: return split_sah(primitives, start, end);
     case bvh_type::middle: return split_middle(primitives, start, end);
     case bvh_type::balanced: return split_balanced(primitives, start, end);
+    case bvh_type::wide: return split_middle(primitives, start, end);
+    case bvh_type::packed: return split_middle(primitives, start, end);
     default: throw std::runtime_error("should not have gotten here");
   }
 }
@@ -1264,107 +1356,176 @@ static void build_bvh_serial(std::vector<bvh_node>& nodes,
   nodes.shrink_to_fit();
 }
 
-#if 0
-
-// Build BVH nodes
-static void build_bvh_parallel(
-    const shared_ptr<bvh_tree>& bvh, std::vector<bbox3f>& bboxes, bvh_type type) {
-  // get values
-  auto& nodes      = bvh->nodes;
-  auto& primitives = bvh->primitives;
+// Minimum number of primitives for a subtree to be built in its own task.
+const int bvh_parallel_prims = 4096;
 
+// Build BVH nodes in parallel. Nodes are allocated from a preallocated
+// array, since a binary tree with non-empty leaves has less than twice as
+// many nodes as primitives. Subtrees larger than `bvh_parallel_prims` are
+// built as separate tasks near the root, and serially below.
+static void build_bvh_parallel(std::vector<bvh_node>& nodes,
+    std::vector<bvh_primitive>& primitives, bvh_type type) {
   // prepare to build nodes
   nodes.clear();
-  nodes.reserve(bboxes.size() * 2);
+  nodes.resize(max((int)primitives.size() * 2 - 1, 1));
+  auto num_nodes = std::atomic<int>{1};
 
-  // prepare primitives
-  bvh->primitives.resize(bboxes.size());
-  for (auto idx = 0; idx < bboxes.size(); idx++) bvh->primitives[idx] = idx;
+  // limit the number of tasks to a few per thread
+  auto max_depth = 2;
+  for (auto n = 1; n < (int)std::thread::hardware_concurrency(); n *= 2)
+    max_depth++;
 
-  // prepare centers
-  auto centers = std::vector<vec3f>(bboxes.size());
-  for (auto idx = 0; idx < bboxes.size(); idx++)
-    centers[idx] = center(bboxes[idx]);
+  // build a node and its subtree
+  auto build_node = [&](auto&& build_node, int nodeid, int start, int end,
+                        int depth) -> void {
+    // grab node
+    auto& node = nodes[nodeid];
 
-  // queue up first node
-  auto queue = std::deque<vec3i>{{0, 0, (int)primitives.size()}};
-  nodes.emplace_back();
+    // compute bounds
+    node.bbox = invalidb3f;
+    for (auto i = start; i < end; i++)
+      node.bbox = merge(node.bbox, primitives[i].bbox);
+
+    // split into two children
+    if (end - start > bvh_max_prims) {
+      // get split
+      auto [mid, axis] = split_nodes(primitives, start, end, type);
 
-  // synchronization
-  std::atomic<int>          num_processed_prims(0);
-  std::mutex                queue_mutex;
-  std::vector<std::future<void>> futures;
-  auto                      nthreads = std::thread::hardware_concurrency();
+      // make an internal node
+      node.internal = true;
+      node.axis     = axis;
+      node.num      = 2;
+      node.start    = num_nodes.fetch_add(2);
+
+      // build children, in parallel if large enough
+      if (end - start > bvh_parallel_prims && depth < max_depth) {
+        auto left = std::async(std::launch::async, [&, start = start,
+                                                       mid = mid] {
+          build_node(build_node, node.start + 0, start, mid, depth + 1);
+        });
+        build_node(build_node, node.start + 1, mid, end, depth + 1);
+        left.get();
+      } else {
+        build_node(build_node, node.start + 0, start, mid, depth + 1);
+        build_node(build_node, node.start + 1, mid, end, depth + 1);
+      }
+    } else {
+      // Make a leaf node
+      node.internal = false;
+      node.num      = end - start;
+      node.start    = start;
+    }
+  };
+  build_node(build_node, 0, 0, (int)primitives.size(), 0);
 
-  // create nodes until the queue is empty
-  for (auto thread_id = 0; thread_id < nthreads; thread_id++) {
-    futures.emplace_back(std::async(
-        std::launch::async, [&nodes, &primitives, &bboxes, &centers, &type,
-                                &num_processed_prims, &queue_mutex, &queue] {
-          while (true) {
-            // exit if needed
-            if (num_processed_prims >= primitives.size()) return;
-
-            // grab node to work on
-            auto next = zero3i;
-            {
-              std::lock_guard<std::mutex> lock{queue_mutex};
-              if (!queue.empty()) {
-                next = queue.front();
-                queue.pop_front();
-              }
-            }
+  // cleanup
+  nodes.resize(num_nodes);
+  nodes.shrink_to_fit();
+}
 
-            // wait a bit if needed
-            if (next == zero3i) {
-              std::this_thread::sleep_for(std::chrono::microseconds(10));
-              continue;
-            }
+// Collapse a binary bvh into a four-wide one. Each wide node takes the
+// children of a binary node and repeatedly opens the largest internal one,
+// until it has four children or only leaves are left.
+static void collapse_bvh(bvh_tree* bvh) {
+  auto& nodes      = bvh->nodes;
+  auto& wide_nodes = bvh->wide_nodes;
+  wide_nodes.clear();
+  if (nodes.empty()) return;
+  wide_nodes.reserve(nodes.size() / 3 + 1);
+
+  // area of a node bounds
+  auto area = [](const bbox3f& bbox) {
+    auto size = bbox.max - bbox.min;
+    return size.x * size.y + size.x * size.z + size.y * size.z;
+  };
 
-            // grab node
-            auto  nodeid = next.x, start = next.y, end = next.z;
-            auto& node = nodes[nodeid];
-
-            // compute bounds
-            node.bbox = invalidb3f;
-            for (auto i = start; i < end; i++)
-              node.bbox = merge(node.bbox, bboxes[primitives[i]]);
-
-            // split into two children
-            if (end - start > bvh_max_prims) {
-              // get split
-              auto [mid, axis] = split_nodes(
-                  primitives, bboxes, centers, start, end, type);
-
-              // make an internal node
-              {
-                std::lock_guard<std::mutex> lock{queue_mutex};
-                node.internal = true;
-                node.axis     = axis;
-                node.num      = 2;
-                node.start    = (int)nodes.size();
-                nodes.emplace_back();
-                nodes.emplace_back();
-                queue.push_back({node.start + 0, start, mid});
-                queue.push_back({node.start + 1, mid, end});
-              }
-            } else {
-              // Make a leaf node
-              node.internal = false;
-              node.num      = end - start;
-              node.start    = start;
-              num_processed_prims += node.num;
-            }
-          }
-        }));
+  // collapse nodes in breadth first order
+  auto queue = std::deque<vec2i>{{0, 0}};
+  wide_nodes.emplace_back();
+  while (!queue.empty()) {
+    auto [nodeid, wideid] = queue.front();
+    queue.pop_front();
+
+    // gather up to four children
+    auto children = std::array<int, 4>{nodeid, -1, -1, -1};
+    auto count    = 1;
+    while (count < 4) {
+      auto open = -1;
+      for (auto idx = 0; idx < count; idx++) {
+        auto& node = nodes[children[idx]];
+        if (!node.internal) continue;
+        if (open < 0 || area(node.bbox) > area(nodes[children[open]].bbox)) {
+          open = idx;
+        }
+      }
+      if (open < 0) break;
+      auto start        = nodes[children[open]].start;
+      children[open]    = start + 0;
+      children[count++] = start + 1;
+    }
+
+    // set children bounds and references
+    for (auto idx = 0; idx < 4; idx++) {
+      auto  valid = idx < count && (nodes[children[idx]].internal ||
+                                      nodes[children[idx]].num > 0);
+      auto  bbox  = valid ? nodes[children[idx]].bbox : invalidb3f;
+      auto& wide  = wide_nodes[wideid];
+      for (auto axis = 0; axis < 3; axis++) {
+        wide.bmin[axis][idx] = bbox.min[axis];
+        wide.bmax[axis][idx] = bbox.max[axis];
+      }
+      if (!valid) {
+        wide.start[idx] = -1;
+        wide.num[idx]   = 0;
+      } else if (nodes[children[idx]].internal) {
+        wide.start[idx] = (int)wide_nodes.size();
+        wide.num[idx]   = 0;
+        queue.push_back({children[idx], (int)wide_nodes.size()});
+        wide_nodes.emplace_back();
+      } else {
+        wide.start[idx] = nodes[children[idx]].start;
+        wide.num[idx]   = nodes[children[idx]].num;
+      }
+    }
   }
-  for (auto& f : futures) f.get();
 
   // cleanup
-  nodes.shrink_to_fit();
+  wide_nodes.shrink_to_fit();
 }
 
-#endif
+// Pack the triangles of each leaf of a wide bvh, and make leaves refer to
+// the packed triangles. Only applies to triangle shapes.
+static void pack_triangles(trc::shape* shape) {
+  auto bvh = shape->bvh;
+  bvh->triangles4.clear();
+  if (shape->triangles.empty()) return;
+  for (auto& node : bvh->wide_nodes) {
+    for (auto idx = 0; idx < 4; idx++) {
+      if (node.num[idx] == 0) continue;
+      auto& packet = bvh->triangles4.emplace_back();
+      for (auto lane = 0; lane < 4; lane++) {
+        auto element = lane < node.num[idx]
+                           ? bvh->primitives[node.start[idx] + lane].x
+                           : -1;
+        auto v0 = zero3f, e1 = zero3f, e2 = zero3f;
+        if (element >= 0) {
+          auto& t = shape->triangles[element];
+          v0      = shape->positions[t.x];
+          e1      = shape->positions[t.y] - v0;
+          e2      = shape->positions[t.z] - v0;
+        }
+        for (auto axis = 0; axis < 3; axis++) {
+          packet.v0[axis][lane] = v0[axis];
+          packet.e1[axis][lane] = e1[axis];
+          packet.e2[axis][lane] = e2[axis];
+        }
+        packet.element[lane] = element;
+      }
+      node.start[idx] = (int)bvh->triangles4.size() - 1;
+    }
+  }
+  bvh->triangles4.shrink_to_fit();
+}
 
 // Update bvh
 static void update_bvh(bvh_tree* bvh, const std::vector<bbox3f>& bboxes) {
@@ -1381,6 +1542,7 @@ static void update_bvh(bvh_tree* bvh, const std::vector<bbox3f>& bboxes) {
       }
     }
   }
+  if (!bvh->wide_nodes.empty()) collapse_bvh(bvh);
 }
 
 static void init_bvh(trc::shape* shape, const trace_params& params) {
@@ -1393,55 +1555,75 @@ static void init_bvh(trc::shape* shape, const trace_params& params) {
   }
 #endif
 
-  // build primitives
-  auto primitives = std::vector<bvh_primitive>{};
-  if (!shape->points.empty()) {
-    for (auto idx = 0; idx < shape->points.size(); idx++) {
-      auto& p             = shape->points[idx];
-      auto& primitive     = primitives.emplace_back();
-      primitive.bbox      = point_bounds(shape->positions[p], shape->radius[p]);
+  // build primitives, computing bounds in parallel
+  auto primitives     = std::vector<bvh_primitive>{};
+  auto set_primitives = [&](int num, int type, auto&& bounds) {
+    primitives.resize(num);
+    parallel_for_batch(num, 4096, !params.noparallel, [&](int idx) {
+      auto& primitive     = primitives[idx];
+      primitive.bbox      = bounds(idx);
       primitive.center    = center(primitive.bbox);
-      primitive.primitive = {idx, 0};
-    }
+      primitive.primitive = {idx, type};
+    });
+  };
+  if (!shape->points.empty()) {
+    set_primitives((int)shape->points.size(), 0, [&](int idx) {
+      auto& p = shape->points[idx];
+      return point_bounds(shape->positions[p], shape->radius[p]);
+    });
   } else if (!shape->lines.empty()) {
-    for (auto idx = 0; idx < shape->lines.size(); idx++) {
-      auto& l         = shape->lines[idx];
-      auto& primitive = primitives.emplace_back();
-      primitive.bbox = line_bounds(shape->positions[l.x], shape->positions[l.y],
+    set_primitives((int)shape->lines.size(), 1, [&](int idx) {
+      auto& l = shape->lines[idx];
+      return line_bounds(shape->positions[l.x], shape->positions[l.y],
           shape->radius[l.x], shape->radius[l.y]);
-      primitive.center    = center(primitive.bbox);
-      primitive.primitive = {idx, 1};
-    }
+    });
   } else if (!shape->triangles.empty()) {
-    for (auto idx = 0; idx < shape->triangles.size(); idx++) {
-      auto& primitive = primitives.emplace_back();
-      auto& t         = shape->triangles[idx];
-      primitive.bbox  = triangle_bounds(
+    set_primitives((int)shape->triangles.size(), 2, [&](int idx) {
+      auto& t = shape->triangles[idx];
+      return triangle_bounds(
           shape->positions[t.x], shape->positions[t.y], shape->positions[t.z]);
-      primitive.center    = center(primitive.bbox);
-      primitive.primitive = {idx, 2};
-    }
+    });
   } else if (!shape->quads.empty()) {
-    for (auto idx = 0; idx < shape->quads.size(); idx++) {
-      auto& q         = shape->quads[idx];
-      auto& primitive = primitives.emplace_back();
-      primitive.bbox = quad_bounds(shape->positions[q.x], shape->positions[q.y],
+    set_primitives((int)shape->quads.size(), 3, [&](int idx) {
+      auto& q = shape->quads[idx];
+      return quad_bounds(shape->positions[q.x], shape->positions[q.y],
           shape->positions[q.z], shape->positions[q.w]);
-      primitive.center    = center(primitive.bbox);
-      primitive.primitive = {idx, 3};
-    }
+    });
   }
 
   // build nodes
   if (shape->bvh) delete shape->bvh;
   shape->bvh = new bvh_tree{};
-  build_bvh_serial(shape->bvh->nodes, primitives, params.bvh);
+  if (params.noparallel) {
+    build_bvh_serial(shape->bvh->nodes, primitives, params.bvh);
+  } else {
+    build_bvh_parallel(shape->bvh->nodes, primitives, params.bvh);
+  }
 
   // set bvh primitives
   shape->bvh->primitives.reserve(primitives.size());
   for (auto& primitive : primitives) {
     shape->bvh->primitives.push_back(primitive.primitive);
   }
+
+  // collapse nodes
+  if (params.bvh == bvh_type::wide || params.bvh == bvh_type::packed) {
+    collapse_bvh(shape->bvh);
+  }
+
+  // pack triangles
+  if (params.bvh == bvh_type::packed) pack_triangles(shape);
+}
+
+// Cache the world transforms of the object instances and their inverses.
+static void init_transforms(trc::object* object) {
+  auto& frames = object->instance->frames;
+  object->transforms.resize(frames.size());
+  for (auto idx = 0; idx < frames.size(); idx++) {
+    auto& transform   = object->transforms[idx];
+    transform.frame   = frames[idx] * object->frame;
+    transform.inverse = inverse(transform.frame, true);
+  }
 }
 
 void init_bvh(trc::scene* scene, const trace_params& params,
@@ -1449,10 +1631,53 @@ void init_bvh(trc::scene* scene, const trace_params& params,
   // handle progress
   auto progress = vec2i{0, 1 + (int)scene->shapes.size()};
 
+  // instance transforms
+  for (auto object : scene->objects) init_transforms(object);
+
   // shapes
-  for (auto idx = 0; idx < scene->shapes.size(); idx++) {
-    if (progress_cb) progress_cb("build shape bvh", progress.x++, progress.y);
-    init_bvh(scene->shapes[idx], params);
+  auto parallel = !params.noparallel;
+#ifdef YOCTO_EMBREE
+  if (params.bvh == bvh_type::embree_default ||
+      params.bvh == bvh_type::embree_highquality ||
+      params.bvh == bvh_type::embree_compact) {
+    parallel = false;
+  }
+#endif
+  if (!parallel) {
+    for (auto idx = 0; idx < scene->shapes.size(); idx++) {
+      if (progress_cb) progress_cb("build shape bvh", progress.x++, progress.y);
+      init_bvh(scene->shapes[idx], params);
+    }
+  } else {
+    // large shapes are built one at a time with parallel builds, while
+    // small shapes are built concurrently with serial builds
+    auto large_shapes = std::vector<trc::shape*>{};
+    auto small_shapes = std::vector<trc::shape*>{};
+    for (auto shape : scene->shapes) {
+      auto num = shape->points.size() + shape->lines.size() +
+                 shape->triangles.size() + shape->quads.size();
+      if (num > bvh_parallel_prims) {
+        large_shapes.push_back(shape);
+      } else {
+        small_shapes.push_back(shape);
+      }
+    }
+    auto progress_mutex = std::mutex{};
+    auto report         = [&]() {
+      if (!progress_cb) return;
+      auto lock = std::lock_guard{progress_mutex};
+      progress_cb("build shape bvh", progress.x++, progress.y);
+    };
+    for (auto shape : large_shapes) {
+      report();
+      init_bvh(shape, params);
+    }
+    auto serial_params       = params;
+    serial_params.noparallel = true;
+    parallel_for_batch((int)small_shapes.size(), 1, true, [&](int idx) {
+      report();
+      init_bvh(small_shapes[idx], serial_params);
+    });
   }
 
   // embree
@@ -1473,11 +1698,11 @@ void init_bvh(trc::scene* scene, const trace_params& params,
   auto empty_instance_frames = std::vector<frame3f>{identity3x4f};
   for (auto object : scene->objects) {
     auto instance_id = 0;
-    for (auto& frame : object->instance->frames) {
+    for (auto& transform : object->transforms) {
       auto& primitive = primitives.emplace_back();
       primitive.bbox  = object->shape->bvh->nodes.empty()
                            ? invalidb3f
-                           : transform_bbox(frame * object->frame,
+                           : transform_bbox(transform.frame,
                                  object->shape->bvh->nodes[0].bbox);
       primitive.center    = center(primitive.bbox);
       primitive.primitive = {object_id, instance_id};
@@ -1489,7 +1714,11 @@ void init_bvh(trc::scene* scene, const trace_params& params,
   // build nodes
   if (scene->bvh) delete scene->bvh;
   scene->bvh = new bvh_tree{};
-  build_bvh_serial(scene->bvh->nodes, primitives, params.bvh);
+  if (params.noparallel) {
+    build_bvh_serial(scene->bvh->nodes, primitives, params.bvh);
+  } else {
+    build_bvh_parallel(scene->bvh->nodes, primitives, params.bvh);
+  }
 
   // set bvh primitives
   scene->bvh->primitives.reserve(primitives.size());
@@ -1497,6 +1726,11 @@ void init_bvh(trc::scene* scene, const trace_params& params,
     scene->bvh->primitives.push_back(primitive.primitive);
   }
 
+  // collapse nodes
+  if (params.bvh == bvh_type::wide || params.bvh == bvh_type::packed) {
+    collapse_bvh(scene->bvh);
+  }
+
   // handle progress
   if (progress_cb) progress_cb("build bvh", progress.x++, progress.y);
 }
@@ -1540,6 +1774,7 @@ static void update_bvh(trc::shape* shape, const trace_params& params) {
 
   // update nodes
   update_bvh(shape->bvh, bboxes);
+  if (!shape->bvh->triangles4.empty()) pack_triangles(shape);
 }
 
 void update_bvh(trc::scene*            scene,
@@ -1549,6 +1784,16 @@ void update_bvh(trc::scene*            scene,
     const trace_params&                params) {
   for (auto shape : updated_shapes) update_bvh(shape, params);
 
+  // instance transforms
+  for (auto object : scene->objects) {
+    if (std::find(updated_objects.begin(), updated_objects.end(), object) !=
+            updated_objects.end() ||
+        std::find(updated_instances.begin(), updated_instances.end(),
+            object->instance) != updated_instances.end()) {
+      init_transforms(object);
+    }
+  }
+
 #ifdef YOCTO_EMBREE
   if (scene->embree_bvh) {
     update_embree_bvh(
@@ -1563,36 +1808,157 @@ void update_bvh(trc::scene*            scene,
     auto object   = scene->objects[instance.x];
     auto sbvh     = object->shape->bvh;
     bboxes[idx]   = transform_bbox(
-        object->instance->frames[instance.y] * object->frame,
-        sbvh->nodes[0].bbox);
+        object->transforms[instance.y].frame, sbvh->nodes[0].bbox);
   }
 
   // update nodes
   update_bvh(scene->bvh, bboxes);
 }
 
-// Intersect ray with a bvh->
-static bool intersect_shape_bvh(trc::shape* shape, const ray3f& ray_,
-    int& element, vec2f& uv, float& distance, bool find_any) {
-#ifdef YOCTO_EMBREE
-  // call Embree if needed
-  if (shape->embree_bvh) {
-    return intersect_shape_embree_bvh(
-        shape, ray_, element, uv, distance, find_any);
+// Intersect a ray with the four children of a wide node. Returns a mask of
+// the children hit and sets their entry distances.
+static int intersect_bbox4(const bvh_node4& node, const ray3f& ray,
+    const vec3f& ray_dinv, const vec3i& ray_dsign, float* tnear) {
+#if defined(__SSE__) || defined(_M_X64)
+  auto t0 = _mm_set1_ps(ray.tmin), t1 = _mm_set1_ps(ray.tmax);
+  for (auto axis = 0; axis < 3; axis++) {
+    auto origin = _mm_set1_ps(ray.o[axis]);
+    auto dinv   = _mm_set1_ps(ray_dinv[axis]);
+    auto near   = _mm_load_ps(
+        ray_dsign[axis] ? node.bmax[axis] : node.bmin[axis]);
+    auto far = _mm_load_ps(
+        ray_dsign[axis] ? node.bmin[axis] : node.bmax[axis]);
+    t0 = _mm_max_ps(t0, _mm_mul_ps(_mm_sub_ps(near, origin), dinv));
+    t1 = _mm_min_ps(t1, _mm_mul_ps(_mm_sub_ps(far, origin), dinv));
+  }
+  t1 = _mm_mul_ps(t1, _mm_set1_ps(1.00000024f));
+  _mm_storeu_ps(tnear, t0);
+  return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+#else
+  auto mask = 0;
+  for (auto idx = 0; idx < 4; idx++) {
+    auto t0 = ray.tmin, t1 = ray.tmax;
+    for (auto axis = 0; axis < 3; axis++) {
+      auto near = ray_dsign[axis] ? node.bmax[axis][idx]
+                                  : node.bmin[axis][idx];
+      auto far  = ray_dsign[axis] ? node.bmin[axis][idx]
+                                  : node.bmax[axis][idx];
+      t0        = max(t0, (near - ray.o[axis]) * ray_dinv[axis]);
+      t1        = min(t1, (far - ray.o[axis]) * ray_dinv[axis]);
+    }
+    tnear[idx] = t0;
+    if (t0 <= t1 * 1.00000024f) mask |= 1 << idx;
   }
+  return mask;
 #endif
+}
 
-  // get bvh and shape pointers for fast access
-  auto bvh = shape->bvh;
+// Intersect a ray with four packed triangles, using the same computation as
+// `intersect_triangle()`. Returns the nearest hit, if any.
+static bool intersect_triangle4(const bvh_triangle4& triangles,
+    const ray3f& ray, int& element, vec2f& uv, float& distance) {
+  float us[4], vs[4], ts[4];
+#if defined(__SSE__) || defined(_M_X64)
+  auto dx = _mm_set1_ps(ray.d.x), dy = _mm_set1_ps(ray.d.y),
+       dz  = _mm_set1_ps(ray.d.z);
+  auto e1x = _mm_load_ps(triangles.e1[0]), e1y = _mm_load_ps(triangles.e1[1]),
+       e1z = _mm_load_ps(triangles.e1[2]);
+  auto e2x = _mm_load_ps(triangles.e2[0]), e2y = _mm_load_ps(triangles.e2[1]),
+       e2z = _mm_load_ps(triangles.e2[2]);
+
+  // compute determinant to solve a linear system
+  auto px      = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+  auto py      = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+  auto pz      = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+  auto det     = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)),
+      _mm_mul_ps(e1z, pz));
+  auto inv_det = _mm_div_ps(_mm_set1_ps(1), det);
+
+  // compute barycentric coordinates
+  auto tx = _mm_sub_ps(_mm_set1_ps(ray.o.x), _mm_load_ps(triangles.v0[0]));
+  auto ty = _mm_sub_ps(_mm_set1_ps(ray.o.y), _mm_load_ps(triangles.v0[1]));
+  auto tz = _mm_sub_ps(_mm_set1_ps(ray.o.z), _mm_load_ps(triangles.v0[2]));
+  auto u  = _mm_mul_ps(
+      _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)),
+          _mm_mul_ps(tz, pz)),
+      inv_det);
+  auto qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+  auto qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+  auto qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+  auto v  = _mm_mul_ps(
+      _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)),
+          _mm_mul_ps(dz, qz)),
+      inv_det);
+
+  // compute ray parameter
+  auto t = _mm_mul_ps(
+      _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)),
+          _mm_mul_ps(e2z, qz)),
+      inv_det);
+
+  // check all conditions at once
+  auto zero = _mm_setzero_ps(), one = _mm_set1_ps(1);
+  auto hits = _mm_and_ps(_mm_cmpneq_ps(det, zero),
+      _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)),
+          _mm_and_ps(_mm_cmpge_ps(v, zero),
+              _mm_cmple_ps(_mm_add_ps(u, v), one))));
+  hits      = _mm_and_ps(hits,
+      _mm_and_ps(_mm_cmpge_ps(t, _mm_set1_ps(ray.tmin)),
+          _mm_cmple_ps(t, _mm_set1_ps(ray.tmax))));
+  auto mask = _mm_movemask_ps(hits);
+  if (!mask) return false;
+  _mm_storeu_ps(us, u);
+  _mm_storeu_ps(vs, v);
+  _mm_storeu_ps(ts, t);
+#else
+  auto mask = 0;
+  for (auto lane = 0; lane < 4; lane++) {
+    auto edge1 = vec3f{triangles.e1[0][lane], triangles.e1[1][lane],
+        triangles.e1[2][lane]};
+    auto edge2 = vec3f{triangles.e2[0][lane], triangles.e2[1][lane],
+        triangles.e2[2][lane]};
+    auto p0    = vec3f{triangles.v0[0][lane], triangles.v0[1][lane],
+        triangles.v0[2][lane]};
+    auto pvec  = cross(ray.d, edge2);
+    auto det   = dot(edge1, pvec);
+    if (det == 0) continue;
+    auto inv_det = 1.0f / det;
+    auto tvec    = ray.o - p0;
+    auto qvec    = cross(tvec, edge1);
+    us[lane]     = dot(tvec, pvec) * inv_det;
+    vs[lane]     = dot(ray.d, qvec) * inv_det;
+    ts[lane]     = dot(edge2, qvec) * inv_det;
+    if (us[lane] < 0 || us[lane] > 1) continue;
+    if (vs[lane] < 0 || us[lane] + vs[lane] > 1) continue;
+    if (ts[lane] < ray.tmin || ts[lane] > ray.tmax) continue;
+    mask |= 1 << lane;
+  }
+  if (!mask) return false;
+#endif
 
+  // pick the nearest hit
+  auto nearest = -1;
+  for (auto lane = 0; lane < 4; lane++) {
+    if (!(mask & (1 << lane))) continue;
+    if (nearest < 0 || ts[lane] <= ts[nearest]) nearest = lane;
+  }
+  element  = triangles.element[nearest];
+  uv       = {us[nearest], vs[nearest]};
+  distance = ts[nearest];
+  return true;
+}
+
+// Traverse a bvh calling `intersect_leaf(start, num, ray)` for the leaves
+// hit by the ray. The leaf function shortens the ray when it finds a hit.
+// Wide nodes are visited from the nearest child, skipping children that
+// start beyond the current hit.
+template <typename Intersect>
+static bool intersect_bvh(const bvh_tree* bvh, const ray3f& ray_,
+    bool find_any, Intersect&& intersect_leaf) {
   // check empty
   if (bvh->nodes.empty()) return false;
 
-  // node stack
-  int  node_stack[128];
-  auto node_cur          = 0;
-  node_stack[node_cur++] = 0;
-
   // shared variables
   auto hit = false;
 
@@ -1604,6 +1970,61 @@ static bool intersect_shape_bvh(trc::shape* shape, const ray3f& ray_,
   auto ray_dsign = vec3i{(ray_dinv.x < 0) ? 1 : 0, (ray_dinv.y < 0) ? 1 : 0,
       (ray_dinv.z < 0) ? 1 : 0};
 
+  // wide bvh
+  if (!bvh->wide_nodes.empty()) {
+    // node stack, storing children references and entry distances
+    int   node_stack[256];
+    int   node_num[256];
+    float node_dist[256];
+    auto  node_cur        = 0;
+    node_stack[node_cur]  = 0;
+    node_num[node_cur]    = 0;
+    node_dist[node_cur++] = ray.tmin;
+
+    // walking stack
+    while (node_cur) {
+      // grab child, skipping it if it starts beyond the current hit
+      node_cur--;
+      if (node_dist[node_cur] > ray.tmax) continue;
+      auto start = node_stack[node_cur], num = node_num[node_cur];
+
+      // intersect leaves
+      if (num) {
+        if (intersect_leaf(start, num, ray)) hit = true;
+        if (find_any && hit) return hit;
+        continue;
+      }
+
+      // intersect children bounds
+      auto& node = bvh->wide_nodes[start];
+      float tnear[4];
+      auto  mask = intersect_bbox4(node, ray, ray_dinv, ray_dsign, tnear);
+
+      // push children hit from farthest to nearest
+      auto first = node_cur;
+      for (auto idx = 0; idx < 4; idx++) {
+        if (!(mask & (1 << idx))) continue;
+        auto pos = node_cur++;
+        while (pos > first && node_dist[pos - 1] < tnear[idx]) {
+          node_stack[pos] = node_stack[pos - 1];
+          node_num[pos]   = node_num[pos - 1];
+          node_dist[pos]  = node_dist[pos - 1];
+          pos--;
+        }
+        node_stack[pos] = node.start[idx];
+        node_num[pos]   = node.num[idx];
+        node_dist[pos]  = tnear[idx];
+      }
+    }
+
+    return hit;
+  }
+
+  // node stack
+  int  node_stack[128];
+  auto node_cur          = 0;
+  node_stack[node_cur++] = 0;
+
   // walking stack
   while (node_cur) {
     // grab node
@@ -1625,59 +2046,100 @@ static bool intersect_shape_bvh(trc::shape* shape, const ray3f& ray_,
         node_stack[node_cur++] = node.start + 1;
         node_stack[node_cur++] = node.start + 0;
       }
-    } else if (!shape->points.empty()) {
-      for (auto idx = node.start; idx < node.start + node.num; idx++) {
-        auto& p = shape->points[shape->bvh->primitives[idx].x];
-        if (intersect_point(
-                ray, shape->positions[p], shape->radius[p], uv, distance)) {
-          hit      = true;
-          element  = shape->bvh->primitives[idx].x;
-          ray.tmax = distance;
-        }
+    } else {
+      if (intersect_leaf(node.start, (int)node.num, ray)) hit = true;
+    }
+
+    // check for early exit
+    if (find_any && hit) return hit;
+  }
+
+  return hit;
+}
+
+// Intersect a ray with the shape elements referred by a bvh leaf, shortening
+// the ray on hits.
+static bool intersect_shape_elements(const trc::shape* shape,
+    const bvh_tree* bvh, int start, int num, ray3f& ray, int& element,
+    vec2f& uv, float& distance) {
+  auto hit = false;
+  if (!shape->points.empty()) {
+    for (auto idx = start; idx < start + num; idx++) {
+      auto& p = shape->points[bvh->primitives[idx].x];
+      if (intersect_point(
+              ray, shape->positions[p], shape->radius[p], uv, distance)) {
+        hit      = true;
+        element  = bvh->primitives[idx].x;
+        ray.tmax = distance;
       }
-    } else if (!shape->lines.empty()) {
-      for (auto idx = node.start; idx < node.start + node.num; idx++) {
-        auto& l = shape->lines[shape->bvh->primitives[idx].x];
-        if (intersect_line(ray, shape->positions[l.x], shape->positions[l.y],
-                shape->radius[l.x], shape->radius[l.y], uv, distance)) {
-          hit      = true;
-          element  = shape->bvh->primitives[idx].x;
-          ray.tmax = distance;
-        }
+    }
+  } else if (!shape->lines.empty()) {
+    for (auto idx = start; idx < start + num; idx++) {
+      auto& l = shape->lines[bvh->primitives[idx].x];
+      if (intersect_line(ray, shape->positions[l.x], shape->positions[l.y],
+              shape->radius[l.x], shape->radius[l.y], uv, distance)) {
+        hit      = true;
+        element  = bvh->primitives[idx].x;
+        ray.tmax = distance;
       }
-    } else if (!shape->triangles.empty()) {
-      for (auto idx = node.start; idx < node.start + node.num; idx++) {
-        auto& t = shape->triangles[shape->bvh->primitives[idx].x];
-        if (intersect_triangle(ray, shape->positions[t.x],
-                shape->positions[t.y], shape->positions[t.z], uv, distance)) {
-          hit      = true;
-          element  = shape->bvh->primitives[idx].x;
-          ray.tmax = distance;
-        }
+    }
+  } else if (!shape->triangles.empty()) {
+    for (auto idx = start; idx < start + num; idx++) {
+      auto& t = shape->triangles[bvh->primitives[idx].x];
+      if (intersect_triangle(ray, shape->positions[t.x],
+              shape->positions[t.y], shape->positions[t.z], uv, distance)) {
+        hit      = true;
+        element  = bvh->primitives[idx].x;
+        ray.tmax = distance;
       }
-    } else if (!shape->quads.empty()) {
-      for (auto idx = node.start; idx < node.start + node.num; idx++) {
-        auto& q = shape->quads[shape->bvh->primitives[idx].x];
-        if (intersect_quad(ray, shape->positions[q.x], shape->positions[q.y],
-                shape->positions[q.z], shape->positions[q.w], uv, distance)) {
-          hit      = true;
-          element  = shape->bvh->primitives[idx].x;
-          ray.tmax = distance;
-        }
+    }
+  } else if (!shape->quads.empty()) {
+    for (auto idx = start; idx < start + num; idx++) {
+      auto& q = shape->quads[bvh->primitives[idx].x];
+      if (intersect_quad(ray, shape->positions[q.x], shape->positions[q.y],
+              shape->positions[q.z], shape->positions[q.w], uv, distance)) {
+        hit      = true;
+        element  = bvh->primitives[idx].x;
+        ray.tmax = distance;
       }
     }
+  }
+  return hit;
+}
 
-    // check for early exit
-    if (find_any && hit) return hit;
+// Intersect ray with a bvh->
+static bool intersect_shape_bvh(trc::shape* shape, const ray3f& ray_,
+    int& element, vec2f& uv, float& distance, bool find_any) {
+#ifdef YOCTO_EMBREE
+  // call Embree if needed
+  if (shape->embree_bvh) {
+    return intersect_shape_embree_bvh(
+        shape, ray_, element, uv, distance, find_any);
   }
+#endif
 
-  return hit;
+  // get bvh and shape pointers for fast access
+  auto bvh = shape->bvh;
+
+  // intersect leaves, switching based on shape type
+  auto intersect_leaf = [&](int start, int num, ray3f& ray) {
+    if (!bvh->triangles4.empty()) {
+      if (!intersect_triangle4(
+              bvh->triangles4[start], ray, element, uv, distance))
+        return false;
+      ray.tmax = distance;
+      return true;
+    }
+    return intersect_shape_elements(
+        shape, bvh, start, num, ray, element, uv, distance);
+  };
+  return intersect_bvh(bvh, ray_, find_any, intersect_leaf);
 }
 
 // Intersect ray with a bvh->
 static bool intersect_scene_bvh(const trc::scene* scene, const ray3f& ray_,
     int& objecct, int& instance, int& element, vec2f& uv, float& distance,
-    bool find_any, bool non_rigid_frames) {
+    bool find_any) {
 #ifdef YOCTO_EMBREE
   // call Embree if needed
   if (scene->embree_bvh) {
@@ -1689,95 +2151,293 @@ static bool intersect_scene_bvh(const trc::scene* scene, const ray3f& ray_,
   // get bvh and scene pointers for fast access
   auto bvh = scene->bvh;
 
-  // check empty
-  if (bvh->nodes.empty()) return false;
+  // intersect instances
+  auto intersect_leaf = [&](int start, int num, ray3f& ray) {
+    auto hit = false;
+    for (auto idx = start; idx < start + num; idx++) {
+      auto [object_id, instance_id] = bvh->primitives[idx];
+      auto object                   = scene->objects[object_id];
+      auto inv_ray                  = transform_ray(
+          object->transforms[instance_id].inverse, ray);
+      if (intersect_shape_bvh(
+              object->shape, inv_ray, element, uv, distance, find_any)) {
+        hit      = true;
+        objecct  = object_id;
+        instance = instance_id;
+        ray.tmax = distance;
+      }
+    }
+    return hit;
+  };
+  return intersect_bvh(bvh, ray_, find_any, intersect_leaf);
+}
 
-  // node stack
-  int  node_stack[128];
-  auto node_cur          = 0;
-  node_stack[node_cur++] = 0;
+// Intersect ray with a bvh->
+static bool intersect_instance_bvh(const trc::object* object, int instance,
+    const ray3f& ray, int& element, vec2f& uv, float& distance,
+    bool find_any) {
+  auto inv_ray = transform_ray(object->transforms[instance].inverse, ray);
+  return intersect_shape_bvh(
+      object->shape, inv_ray, element, uv, distance, find_any);
+}
 
-  // shared variables
-  auto hit = false;
+// Number of rays traced together in a packet.
+const int bvh_packet_size = 16;
+
+// Packet of rays traversed together. Ray origins and inverse directions are
+// also stored as structure of arrays to test all rays against a box at once.
+// Rays are enabled by bitmasks of lanes, and all enabled rays share the same
+// direction signs.
+struct alignas(16) bvh_packet {
+  ray3f rays[bvh_packet_size];
+  float origin[3][bvh_packet_size];
+  float dinv[3][bvh_packet_size];
+  float tmin[bvh_packet_size];
+  float tmax[bvh_packet_size];
+  vec3i dsign;
+};
 
-  // copy ray to modify it
-  auto ray = ray_;
+// Initialize a packet from the rays of the enabled lanes. Returns false if
+// the rays are not coherent enough to be traced together.
+static bool init_packet(bvh_packet& packet, const ray3f* rays, int lanes) {
+  auto first = true;
+  for (auto lane = 0; lane < bvh_packet_size; lane++) {
+    auto enabled = (lanes & (1 << lane)) != 0;
+    auto ray     = enabled ? rays[lane] : ray3f{zero3f, {1, 1, 1}, 0, 0};
+    auto dinv    = vec3f{1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z};
+    auto dsign   = vec3i{(dinv.x < 0) ? 1 : 0, (dinv.y < 0) ? 1 : 0,
+        (dinv.z < 0) ? 1 : 0};
+    if (enabled && first) packet.dsign = dsign;
+    if (enabled && !first && packet.dsign != dsign) return false;
+    if (enabled) first = false;
+    packet.rays[lane] = ray;
+    for (auto axis = 0; axis < 3; axis++) {
+      packet.origin[axis][lane] = ray.o[axis];
+      packet.dinv[axis][lane]   = dinv[axis];
+    }
+    packet.tmin[lane] = ray.tmin;
+    packet.tmax[lane] = ray.tmax;
+  }
+  return true;
+}
 
-  // prepare ray for fast queries
-  auto ray_dinv  = vec3f{1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z};
-  auto ray_dsign = vec3i{(ray_dinv.x < 0) ? 1 : 0, (ray_dinv.y < 0) ? 1 : 0,
-      (ray_dinv.z < 0) ? 1 : 0};
+// Intersect the enabled rays of a packet with a box, using the same
+// computation as `intersect_bbox()`. Returns the lanes that hit the box.
+static int intersect_bbox(
+    const bvh_packet& packet, const bbox3f& bbox, int lanes) {
+  auto mask = 0;
+  for (auto group = 0; group < bvh_packet_size; group += 4) {
+    if (!((lanes >> group) & 15)) continue;
+#if defined(__SSE__) || defined(_M_X64)
+    auto t0 = _mm_load_ps(packet.tmin + group);
+    auto t1 = _mm_load_ps(packet.tmax + group);
+    for (auto axis = 0; axis < 3; axis++) {
+      auto origin = _mm_load_ps(packet.origin[axis] + group);
+      auto dinv   = _mm_load_ps(packet.dinv[axis] + group);
+      auto it_min = _mm_mul_ps(
+          _mm_sub_ps(_mm_set1_ps(bbox.min[axis]), origin), dinv);
+      auto it_max = _mm_mul_ps(
+          _mm_sub_ps(_mm_set1_ps(bbox.max[axis]), origin), dinv);
+      t0 = _mm_max_ps(t0, _mm_min_ps(it_min, it_max));
+      t1 = _mm_min_ps(t1, _mm_max_ps(it_min, it_max));
+    }
+    t1 = _mm_mul_ps(t1, _mm_set1_ps(1.00000024f));
+    mask |= _mm_movemask_ps(_mm_cmple_ps(t0, t1)) << group;
+#else
+    for (auto lane = group; lane < group + 4; lane++) {
+      auto t0 = packet.tmin[lane], t1 = packet.tmax[lane];
+      for (auto axis = 0; axis < 3; axis++) {
+        auto it_min = (bbox.min[axis] - packet.origin[axis][lane]) *
+                      packet.dinv[axis][lane];
+        auto it_max = (bbox.max[axis] - packet.origin[axis][lane]) *
+                      packet.dinv[axis][lane];
+        t0 = max(t0, min(it_min, it_max));
+        t1 = min(t1, max(it_min, it_max));
+      }
+      if (t0 <= t1 * 1.00000024f) mask |= 1 << lane;
+    }
+#endif
+  }
+  return mask & lanes;
+}
+
+// Traverse a bvh with a packet of rays, calling `intersect_leaf(start, num,
+// lanes)` for the leaves hit by any of the enabled rays. The leaf function
+// returns the lanes with hits and shortens their rays. Returns the lanes
+// with hits.
+template <typename Intersect>
+static int intersect_bvh(const bvh_tree* bvh, const bvh_packet& packet,
+    int lanes, bool find_any, Intersect&& intersect_leaf) {
+  // check empty
+  if (bvh->nodes.empty()) return 0;
+
+  // shared variables
+  auto hits = 0;
+
+  // node stack, storing the lanes that hit the parent
+  int  node_stack[128];
+  int  node_lanes[128];
+  auto node_cur          = 0;
+  node_stack[node_cur]   = 0;
+  node_lanes[node_cur++] = lanes;
 
   // walking stack
   while (node_cur) {
     // grab node
-    auto& node = bvh->nodes[node_stack[--node_cur]];
+    node_cur--;
+    auto& node  = bvh->nodes[node_stack[node_cur]];
+    auto  alive = node_lanes[node_cur] & lanes;
 
     // intersect bbox
-    // if (!intersect_bbox(ray, ray_dinv, ray_dsign, node.bbox)) continue;
-    if (!intersect_bbox(ray, ray_dinv, node.bbox)) continue;
+    alive = intersect_bbox(packet, node.bbox, alive);
+    if (!alive) continue;
 
-    // intersect node, switching based on node type
-    // for each type, iterate over the the primitive list
+    // intersect node, visiting children in the packet direction
     if (node.internal) {
-      // for internal nodes, attempts to proceed along the
-      // split axis from smallest to largest nodes
-      if (ray_dsign[node.axis]) {
-        node_stack[node_cur++] = node.start + 0;
-        node_stack[node_cur++] = node.start + 1;
-      } else {
-        node_stack[node_cur++] = node.start + 1;
-        node_stack[node_cur++] = node.start + 0;
-      }
+      auto first = packet.dsign[node.axis] ? 0 : 1;
+      node_stack[node_cur]   = node.start + first;
+      node_lanes[node_cur++] = alive;
+      node_stack[node_cur]   = node.start + 1 - first;
+      node_lanes[node_cur++] = alive;
     } else {
-      for (auto idx = node.start; idx < node.start + node.num; idx++) {
-        auto [object_id, instance_id] = scene->bvh->primitives[idx];
-        auto object                   = scene->objects[object_id];
-        auto frame   = object->instance->frames[instance_id] * object->frame;
-        auto inv_ray = transform_ray(inverse(frame, non_rigid_frames), ray);
-        if (intersect_shape_bvh(
-                object->shape, inv_ray, element, uv, distance, find_any)) {
-          hit      = true;
-          objecct  = object_id;
-          instance = instance_id;
-          ray.tmax = distance;
-        }
-      }
+      auto leaf_hits = intersect_leaf(node.start, (int)node.num, alive);
+      hits |= leaf_hits;
+      // rays that found any hit are done
+      if (find_any) lanes &= ~leaf_hits;
+      if (!lanes) return hits;
     }
-
-    // check for early exit
-    if (find_any && hit) return hit;
   }
 
-  return hit;
+  return hits;
 }
 
-// Intersect ray with a bvh->
-static bool intersect_instance_bvh(const trc::object* object, int instance,
-    const ray3f& ray, int& element, vec2f& uv, float& distance, bool find_any,
-    bool non_rigid_frames) {
-  auto frame   = object->instance->frames[instance] * object->frame;
-  auto inv_ray = transform_ray(inverse(frame, non_rigid_frames), ray);
-  return intersect_shape_bvh(
-      object->shape, inv_ray, element, uv, distance, find_any);
+// Intersect the enabled rays with a shape bvh. Rays that are not coherent
+// are traced one at a time, as are rays against wide bvhs, since packets
+// only walk binary nodes and would skip the wide nodes and packed leaves.
+static int intersect_shape_bvh(trc::shape* shape, const ray3f* rays,
+    int lanes, intersection3f* intersections, bool find_any) {
+  auto packet   = bvh_packet{};
+  auto coherent = init_packet(packet, rays, lanes);
+#ifdef YOCTO_EMBREE
+  if (shape->embree_bvh) coherent = false;
+#endif
+  if (coherent && !shape->bvh->wide_nodes.empty()) coherent = false;
+
+  // trace rays one at a time
+  if (!coherent) {
+    auto hits = 0;
+    for (auto lane = 0; lane < bvh_packet_size; lane++) {
+      if (!(lanes & (1 << lane))) continue;
+      auto& intersection = intersections[lane];
+      if (intersect_shape_bvh(shape, rays[lane], intersection.element,
+              intersection.uv, intersection.distance, find_any))
+        hits |= 1 << lane;
+    }
+    return hits;
+  }
+
+  // trace packet
+  auto bvh            = shape->bvh;
+  auto intersect_leaf = [&](int start, int num, int alive) {
+    auto hits = 0;
+    for (auto lane = 0; lane < bvh_packet_size; lane++) {
+      if (!(alive & (1 << lane))) continue;
+      auto& intersection = intersections[lane];
+      if (intersect_shape_elements(shape, bvh, start, num, packet.rays[lane],
+              intersection.element, intersection.uv, intersection.distance)) {
+        packet.tmax[lane] = packet.rays[lane].tmax;
+        hits |= 1 << lane;
+      }
+    }
+    return hits;
+  };
+  return intersect_bvh(bvh, packet, lanes, find_any, intersect_leaf);
 }
 
-intersection3f intersect_scene_bvh(const trc::scene* scene, const ray3f& ray,
-    bool find_any, bool non_rigid_frames) {
+// Intersect the enabled rays with the scene bvh. Rays that are not coherent
+// are traced one at a time, as are rays against wide bvhs.
+static void intersect_scene_bvh(const trc::scene* scene, const ray3f* rays,
+    int lanes, intersection3f* intersections, bool find_any) {
+  auto packet   = bvh_packet{};
+  auto coherent = init_packet(packet, rays, lanes);
+#ifdef YOCTO_EMBREE
+  if (scene->embree_bvh) coherent = false;
+#endif
+  if (coherent && !scene->bvh->wide_nodes.empty()) coherent = false;
+
+  // trace rays one at a time
+  if (!coherent) {
+    for (auto lane = 0; lane < bvh_packet_size; lane++) {
+      if (!(lanes & (1 << lane))) continue;
+      intersections[lane] = intersect_scene_bvh(scene, rays[lane], find_any);
+    }
+    return;
+  }
+
+  // trace packet, transforming the rays of each instance
+  auto bvh            = scene->bvh;
+  auto intersect_leaf = [&](int start, int num, int alive) {
+    auto hits = 0;
+    for (auto idx = start; idx < start + num && alive; idx++) {
+      auto [object_id, instance_id] = bvh->primitives[idx];
+      auto object                   = scene->objects[object_id];
+      auto& inverse = object->transforms[instance_id].inverse;
+      ray3f          inv_rays[bvh_packet_size];
+      intersection3f shape_intersections[bvh_packet_size];
+      for (auto lane = 0; lane < bvh_packet_size; lane++) {
+        if (!(alive & (1 << lane))) continue;
+        inv_rays[lane] = transform_ray(inverse, packet.rays[lane]);
+      }
+      auto shape_hits = intersect_shape_bvh(
+          object->shape, inv_rays, alive, shape_intersections, find_any);
+      for (auto lane = 0; lane < bvh_packet_size; lane++) {
+        if (!(shape_hits & (1 << lane))) continue;
+        auto& intersection     = intersections[lane];
+        intersection           = shape_intersections[lane];
+        intersection.object    = object_id;
+        intersection.instance  = instance_id;
+        packet.rays[lane].tmax = intersection.distance;
+        packet.tmax[lane]      = intersection.distance;
+      }
+      hits |= shape_hits;
+      if (find_any) alive &= ~shape_hits;
+    }
+    return hits;
+  };
+  auto hits = intersect_bvh(bvh, packet, lanes, find_any, intersect_leaf);
+  for (auto lane = 0; lane < bvh_packet_size; lane++) {
+    if (!(lanes & (1 << lane))) continue;
+    intersections[lane].hit = (hits & (1 << lane)) != 0;
+  }
+}
+
+// The cached inverses are always full inverses, so non-rigid frames need no
+// special handling and the flag is unused.
+intersection3f intersect_scene_bvh(
+    const trc::scene* scene, const ray3f& ray, bool find_any, bool) {
   auto intersection = intersection3f{};
   intersection.hit  = intersect_scene_bvh(scene, ray, intersection.object,
       intersection.instance, intersection.element, intersection.uv,
-      intersection.distance, find_any, non_rigid_frames);
+      intersection.distance, find_any);
   return intersection;
 }
 intersection3f intersect_instance_bvh(const trc::object* object, int instance,
-    const ray3f& ray, bool find_any, bool non_rigid_frames) {
+    const ray3f& ray, bool find_any, bool) {
   auto intersection = intersection3f{};
   intersection.hit  = intersect_instance_bvh(object, instance, ray,
-      intersection.element, intersection.uv, intersection.distance, find_any,
-      non_rigid_frames);
+      intersection.element, intersection.uv, intersection.distance, find_any);
   return intersection;
 }
+void intersect_scene_bvh(const trc::scene* scene,
+    const std::vector<ray3f>& rays, std::vector<intersection3f>& intersections,
+    bool find_any) {
+  intersections.assign(rays.size(), intersection3f{});
+  for (auto start = 0; start < (int)rays.size(); start += bvh_packet_size) {
+    auto num = min((int)rays.size() - start, bvh_packet_size);
+    intersect_scene_bvh(scene, rays.data() + start, (1 << num) - 1,
+        intersections.data() + start, find_any);
+  }
+}
 
 }  // namespace yocto::trace
 
@@ -2178,7 +2838,7 @@ static vec3f sample_lights(const trc::scene* scene, const vec3f& position,
   if (light->object) {
     auto& object    = light->object;
     auto  shape     = object->shape;
-    auto  frame     = object->instance->frames[light->instance] * object->frame;
+    auto& frame     = object->transforms[light->instance].frame;
     auto  element   = sample_discrete(shape->elements_cdf, rel);
     auto  uv        = (!shape->triangles.empty()) ? sample_triangle(ruv) : ruv;
     auto  lposition = transform_point(
@@ -2213,7 +2873,7 @@ static float sample_lights_pdf(
       auto  lpdf          = 0.0f;
       auto  next_position = position;
       auto& object        = light->object;
-      auto  frame = object->instance->frames[light->instance] * object->frame;
+      auto& frame         = object->transforms[light->instance].frame;
       for (auto bounce = 0; bounce < 100; bounce++) {
         auto intersection = intersect_instance_bvh(
             light->object, light->instance, {next_position, direction});
@@ -2259,19 +2919,20 @@ static float sample_lights_pdf(
 
 // Recursive path tracing.
 static std::pair<vec3f, bool> trace_path(const trc::scene* scene,
-    const ray3f& ray_, rng_state& rng, const trace_params& params) {
+    const ray3f& ray_, const intersection3f& primary, rng_state& rng,
+    const trace_params& params) {
   // initialize
   auto radiance      = zero3f;
   auto weight        = vec3f{1, 1, 1};
   auto ray           = ray_;
-  auto volume_stack  = std::vector<volume_point>{};
+  auto volume_stack  = fixed_stack<volume_point, max_volumes>{};
   auto max_roughness = 0.0f;
   auto hit           = false;
 
   // trace  path
   for (auto bounce = 0; bounce < params.bounces; bounce++) {
     // intersect next point
-    auto intersection = intersect_scene_bvh(scene, ray);
+    auto intersection = bounce ? intersect_scene_bvh(scene, ray) : primary;
     if (!intersection.hit) {
       radiance += weight * eval_environment(scene, ray);
       break;
@@ -2388,7 +3049,8 @@ static std::pair<vec3f, bool> trace_path(const trc::scene* scene,
 
 // Recursive path tracing.
 static std::pair<vec3f, bool> trace_naive(const trc::scene* scene,
-    const ray3f& ray_, rng_state& rng, const trace_params& params) {
+    const ray3f& ray_, const intersection3f& primary, rng_state& rng,
+    const trace_params& params) {
   // initialize
   auto radiance = zero3f;
   auto weight   = vec3f{1, 1, 1};
@@ -2398,7 +3060,7 @@ static std::pair<vec3f, bool> trace_naive(const trc::scene* scene,
   // trace  path
   for (auto bounce = 0; bounce < params.bounces; bounce++) {
     // intersect next point
-    auto intersection = intersect_scene_bvh(scene, ray);
+    auto intersection = bounce ? intersect_scene_bvh(scene, ray) : primary;
     if (!intersection.hit) {
       radiance += weight * eval_environment(scene, ray);
       break;
@@ -2446,7 +3108,8 @@ static std::pair<vec3f, bool> trace_naive(const trc::scene* scene,
 
 // Eyelight for quick previewing.
 static std::pair<vec3f, bool> trace_eyelight(const trc::scene* scene,
-    const ray3f& ray_, rng_state& rng, const trace_params& params) {
+    const ray3f& ray_, const intersection3f& primary, rng_state& rng,
+    const trace_params& params) {
   // initialize
   auto radiance = zero3f;
   auto weight   = vec3f{1, 1, 1};
@@ -2456,7 +3119,7 @@ static std::pair<vec3f, bool> trace_eyelight(const trc::scene* scene,
   // trace  path
   for (auto bounce = 0; bounce < max(params.bounces, 4); bounce++) {
     // intersect next point
-    auto intersection = intersect_scene_bvh(scene, ray);
+    auto intersection = bounce ? intersect_scene_bvh(scene, ray) : primary;
     if (!intersection.hit) {
       radiance += weight * eval_environment(scene, ray);
       break;
@@ -2495,9 +3158,10 @@ static std::pair<vec3f, bool> trace_eyelight(const trc::scene* scene,
 
 // False color rendering
 static std::pair<vec3f, bool> trace_falsecolor(const trc::scene* scene,
-    const ray3f& ray, rng_state& rng, const trace_params& params) {
-  // intersect next point
-  auto intersection = intersect_scene_bvh(scene, ray);
+    const ray3f& ray, const intersection3f& primary, rng_state& rng,
+    const trace_params& params) {
+  // use the primary intersection
+  auto& intersection = primary;
   if (!intersection.hit) {
     return {zero3f, false};
   }
@@ -2546,9 +3210,11 @@ static std::pair<vec3f, bool> trace_falsecolor(const trc::scene* scene,
   }
 }
 
-// Trace a single ray from the camera using the given algorithm.
+// Trace a single ray from the camera using the given algorithm, starting
+// from the already computed intersection of the camera ray.
 using sampler_func = std::pair<vec3f, bool> (*)(const trc::scene* scene,
-    const ray3f& ray, rng_state& rng, const trace_params& params);
+    const ray3f& ray, const intersection3f& primary, rng_state& rng,
+    const trace_params& params);
 static sampler_func get_trace_sampler_func(const trace_params& params) {
   switch (params.sampler) {
     case sampler_type::path: return trace_path;
@@ -2576,14 +3242,9 @@ bool is_sampler_lit(const trace_params& params) {
   }
 }
 
-// Trace a block of samples
-vec4f trace_sample(trc::state* state, const trc::scene* scene,
-    const trc::camera* camera, const vec2i& ij, const trace_params& params) {
-  auto  sampler = get_trace_sampler_func(params);
-  auto& pixel   = state->pixels[ij];
-  auto  ray = sample_camera(camera, ij, state->pixels.size(), rand2f(pixel.rng),
-      rand2f(pixel.rng), params.tentfilter);
-  auto [radiance, hit] = sampler(scene, ray, pixel.rng, params);
+// Accumulate a sample in a pixel, returning the pixel value
+static vec4f accumulate_sample(trc::pixel& pixel, const trc::scene* scene,
+    vec3f radiance, bool hit, const trace_params& params) {
   if (!hit) {
     if (params.envhidden || scene->environments.empty()) {
       radiance = zero3f;
@@ -2595,13 +3256,66 @@ vec4f trace_sample(trc::state* state, const trc::scene* scene,
   if (!isfinite(radiance)) radiance = zero3f;
   if (max(radiance) > params.clamp)
     radiance = radiance * (params.clamp / max(radiance));
+  auto lum = luminance(radiance);
   pixel.radiance += radiance;
+  pixel.luminance2 += lum * lum;
   pixel.hits += hit ? 1 : 0;
   pixel.samples += 1;
   return {pixel.hits ? pixel.radiance / pixel.hits : zero3f,
       (float)pixel.hits / (float)pixel.samples};
 }
 
+// Trace a block of samples
+vec4f trace_sample(trc::state* state, const trc::scene* scene,
+    const trc::camera* camera, const vec2i& ij, const trace_params& params) {
+  auto  sampler = get_trace_sampler_func(params);
+  auto& pixel   = state->pixels[ij];
+  auto  ray = sample_camera(camera, ij, state->pixels.size(), rand2f(pixel.rng),
+      rand2f(pixel.rng), params.tentfilter);
+  auto intersection    = intersect_scene_bvh(scene, ray);
+  auto [radiance, hit] = sampler(scene, ray, intersection, pixel.rng, params);
+  return accumulate_sample(pixel, scene, radiance, hit, params);
+}
+
+// Size of the square blocks of pixels whose camera rays form a packet.
+const int trace_block_size = 4;
+
+// Trace a sample for each pixel of a block of `trace_block_size` pixels
+// squared, intersecting the camera rays together as a packet.
+static void trace_block(trc::state* state, const trc::scene* scene,
+    const trc::camera* camera, const vec2i& block, sampler_func sampler,
+    const trace_params& params) {
+  auto           size = state->pixels.size();
+  ray3f          rays[bvh_packet_size];
+  intersection3f intersections[bvh_packet_size];
+
+  // generate camera rays
+  auto lanes = 0;
+  for (auto lane = 0; lane < bvh_packet_size; lane++) {
+    auto ij = block * trace_block_size +
+              vec2i{lane % trace_block_size, lane / trace_block_size};
+    if (ij.x >= size.x || ij.y >= size.y) continue;
+    auto& pixel = state->pixels[ij];
+    rays[lane]  = sample_camera(camera, ij, size, rand2f(pixel.rng),
+        rand2f(pixel.rng), params.tentfilter);
+    lanes |= 1 << lane;
+  }
+
+  // intersect camera rays
+  intersect_scene_bvh(scene, rays, lanes, intersections, false);
+
+  // continue each path
+  for (auto lane = 0; lane < bvh_packet_size; lane++) {
+    if (!(lanes & (1 << lane))) continue;
+    auto  ij             = block * trace_block_size +
+              vec2i{lane % trace_block_size, lane / trace_block_size};
+    auto& pixel          = state->pixels[ij];
+    auto [radiance, hit] = sampler(
+        scene, rays[lane], intersections[lane], pixel.rng, params);
+    state->render[ij] = accumulate_sample(pixel, scene, radiance, hit, params);
+  }
+}
+
 // Init a sequence of random number generators.
 void init_state(trc::state* state, const trc::scene* scene,
     const trc::camera* camera, const trace_params& params) {
@@ -2614,6 +3328,7 @@ void init_state(trc::state* state, const trc::scene* scene,
                 params.resolution};
   state->pixels.assign(image_size, pixel{});
   state->render.assign(image_size, zero4f);
+  state->samples = 0;
   auto rng = make_rng(1301081);
   for (auto& pixel : state->pixels) {
     pixel.rng = make_rng(params.seed, rand1i(rng, 1 << 31) / 2 + 1);
@@ -2694,53 +3409,256 @@ using std::atomic;
 using std::deque;
 using std::future;
 
-// Simple parallel for used since our target platforms do not yet support
-// parallel algorithms. `Func` takes the integer index.
-template <typename Func>
-inline void parallel_for(const vec2i& size, Func&& func) {
-  auto             futures  = std::vector<std::future<void>>{};
-  auto             nthreads = std::thread::hardware_concurrency();
-  std::atomic<int> next_idx(0);
+// Size of the square tiles of pixels handed out to rendering threads.
+const int trace_tile_size = 32;
+
+// Number of samples rendered in a tile before moving to the next one, when
+// no intermediate images are requested.
+const int trace_tile_samples = 16;
+
+// Interleave the bits of the coordinates to get a Morton code.
+static uint64_t morton_code(const vec2i& ij) {
+  auto code = (uint64_t)0;
+  for (auto bit = 0; bit < 32; bit++) {
+    code |= (uint64_t)((ij.x >> bit) & 1) << (2 * bit + 0);
+    code |= (uint64_t)((ij.y >> bit) & 1) << (2 * bit + 1);
+  }
+  return code;
+}
+
+// Make the tiles covering an image, sorted in Morton order so that nearby
+// tiles, which access similar parts of the scene, are rendered together.
+static std::vector<vec2i> make_tiles(const vec2i& size) {
+  auto count = (size + trace_tile_size - 1) / trace_tile_size;
+  auto tiles = std::vector<vec2i>{};
+  tiles.reserve((size_t)count.x * (size_t)count.y);
+  for (auto j = 0; j < count.y; j++) {
+    for (auto i = 0; i < count.x; i++) tiles.push_back({i, j});
+  }
+  std::sort(tiles.begin(), tiles.end(), [](const vec2i& a, const vec2i& b) {
+    return morton_code(a) < morton_code(b);
+  });
+  return tiles;
+}
+
+// Render tiles in passes with threads that persist for the whole render.
+// Each thread owns a contiguous range of the tiles, taken from its front,
+// and idle threads steal tiles from the back of the other ranges. Calls
+// `render_tile(tile, pass)` for each tile in each pass, then calls
+// `end_pass(pass)` on one thread while the others wait. Stops early if
+// `end_pass` returns false. If a callback throws, all threads stop at the
+// next barrier and the first exception is rethrown once they have joined.
+template <typename Tile, typename Pass>
+static void parallel_tiles(const std::vector<vec2i>& tiles, int passes,
+    bool parallel, Tile&& render_tile, Pass&& end_pass) {
+  // serial loop
+  auto nthreads = parallel ? (int)std::thread::hardware_concurrency() : 1;
+  if (nthreads <= 1) {
+    for (auto pass = 0; pass < passes; pass++) {
+      for (auto& tile : tiles) render_tile(tile, pass);
+      if (!end_pass(pass)) return;
+    }
+    return;
+  }
+
+  // ranges of tiles owned by each thread
+  struct tile_range {
+    std::mutex mutex;
+    int        front = 0, back = 0;
+  };
+  auto ranges     = std::vector<tile_range>(nthreads);
+  auto init_range = [&](int thread_id) {
+    auto num                = (int)tiles.size();
+    ranges[thread_id].front = (int)((int64_t)num * thread_id / nthreads);
+    ranges[thread_id].back = (int)((int64_t)num * (thread_id + 1) / nthreads);
+  };
   for (auto thread_id = 0; thread_id < nthreads; thread_id++) {
-    futures.emplace_back(
-        std::async(std::launch::async, [&func, &next_idx, size]() {
-          while (true) {
-            auto j = next_idx.fetch_add(1);
-            if (j >= size.y) break;
-            for (auto i = 0; i < size.x; i++) func({i, j});
+    init_range(thread_id);
+  }
+
+  // take a tile from the own range, or steal it from the others
+  auto next_tile = [&](int thread_id) {
+    for (auto offset = 0; offset < nthreads; offset++) {
+      auto& range = ranges[(thread_id + offset) % nthreads];
+      auto  lock  = std::lock_guard{range.mutex};
+      if (range.front >= range.back) continue;
+      return offset == 0 ? range.front++ : --range.back;
+    }
+    return -1;
+  };
+
+  // barrier at the end of each pass
+  auto mutex      = std::mutex{};
+  auto condition  = std::condition_variable{};
+  auto arrived    = 0;
+  auto generation = 0;
+  auto stopped    = false;
+
+  // first exception thrown by a callback, checked at the next barrier
+  auto failed = std::atomic<bool>{false};
+  auto error  = std::exception_ptr{};
+
+  auto futures = std::vector<std::future<void>>{};
+  for (auto thread_id = 0; thread_id < nthreads; thread_id++) {
+    futures.emplace_back(std::async(std::launch::async, [&, thread_id]() {
+      for (auto pass = 0; pass < passes; pass++) {
+        try {
+          for (auto idx = next_tile(thread_id); idx >= 0 && !failed;
+               idx      = next_tile(thread_id)) {
+            render_tile(tiles[idx], pass);
+          }
+        } catch (...) {
+          auto lock = std::lock_guard{mutex};
+          if (!error) error = std::current_exception();
+          failed = true;
+        }
+        auto lock = std::unique_lock{mutex};
+        if (++arrived == nthreads) {
+          arrived = 0;
+          try {
+            if (failed || !end_pass(pass)) stopped = true;
+          } catch (...) {
+            if (!error) error = std::current_exception();
+            stopped = true;
           }
-        }));
+          for (auto idx = 0; idx < nthreads; idx++) init_range(idx);
+          generation++;
+          condition.notify_all();
+        } else {
+          auto current = generation;
+          condition.wait(lock, [&] { return generation != current; });
+        }
+        if (stopped) return;
+      }
+    }));
   }
   for (auto& f : futures) f.get();
+  if (error) std::rethrow_exception(error);
+}
+
+// Minimum number of samples per pixel before adaptive sampling can stop.
+const int trace_adaptive_samples = 16;
+
+// Estimate the error of a pixel from the variance of the luminance of its
+// samples. The error is relative to the square root of the luminance, which
+// approximates the display gamma, so that dark regions are not oversampled.
+static float pixel_error(const trc::pixel& pixel) {
+  if (pixel.samples < 2) return flt_max;
+  auto num      = (float)pixel.samples;
+  auto mean     = luminance(pixel.radiance) / num;
+  auto variance = max(pixel.luminance2 / num - mean * mean, 0.0f) / (num - 1);
+  return sqrt(variance / max(mean, 0.0001f));
+}
+
+// Check if the pixels of a block have reached the target error of adaptive
+// sampling. Errors are averaged over the block since the estimates of single
+// pixels are noisy.
+static bool is_block_converged(const trc::state* state, const vec2i& block,
+    const trace_params& params) {
+  auto size  = state->pixels.size();
+  auto error = 0.0f;
+  auto count = 0;
+  for (auto j = 0; j < trace_block_size; j++) {
+    for (auto i = 0; i < trace_block_size; i++) {
+      auto ij = block * trace_block_size + vec2i{i, j};
+      if (ij.x >= size.x || ij.y >= size.y) continue;
+      auto& pixel = state->pixels[ij];
+      if (pixel.samples < trace_adaptive_samples) return false;
+      error += pixel_error(pixel);
+      count += 1;
+    }
+  }
+  return count > 0 && error / count < params.adaptive;
+}
+
+// Render the samples of a pass for all the blocks of a tile, skipping the
+// converged blocks when sampling adaptively. Returns the number of blocks
+// traced.
+static int trace_tile(trc::state* state, const trc::scene* scene,
+    const trc::camera* camera, const vec2i& tile, int samples,
+    sampler_func sampler, const trace_params& params) {
+  auto size   = state->render.size();
+  auto blocks = trace_tile_size / trace_block_size;
+  auto traced = 0;
+  for (auto sample = 0; sample < samples; sample++) {
+    for (auto j = 0; j < blocks; j++) {
+      for (auto i = 0; i < blocks; i++) {
+        auto block = tile * blocks + vec2i{i, j};
+        if (block.x * trace_block_size >= size.x) continue;
+        if (block.y * trace_block_size >= size.y) continue;
+        if (params.adaptive > 0 && is_block_converged(state, block, params))
+          continue;
+        trace_block(state, scene, camera, block, sampler, params);
+        traced += 1;
+      }
+    }
+  }
+  return traced;
+}
+
+// Update the number of samples traced, the maximum over the pixels.
+static void update_samples(trc::state* state) {
+  auto samples = (int)state->samples;
+  for (auto& pixel : state->pixels) samples = max(samples, pixel.samples);
+  state->samples = samples;
+}
+
+// Check if the time budget of a render, started at `start`, ran out.
+static bool is_budget_over(
+    std::chrono::steady_clock::time_point start, const trace_params& params) {
+  if (params.budget <= 0) return false;
+  auto elapsed = std::chrono::duration<float>(
+      std::chrono::steady_clock::now() - start);
+  return elapsed.count() >= params.budget;
 }
 
 // Progressively compute an image by calling trace_samples multiple times.
 img::image<vec4f> trace_image(const trc::scene* scene,
     const trc::camera* camera, const trace_params& params,
     progress_callback progress_cb, image_callback image_cb) {
+  auto samples = 0;
+  return trace_image(scene, camera, params, samples, progress_cb, image_cb);
+}
+img::image<vec4f> trace_image(const trc::scene* scene,
+    const trc::camera* camera, const trace_params& params, int& samples,
+    progress_callback progress_cb, image_callback image_cb) {
   auto state_guard = std::make_unique<state>();
   auto state       = state_guard.get();
   init_state(state, scene, camera, params);
+  auto start = std::chrono::steady_clock::now();
+
+  // render tiles in passes, with one sample per pass if images are reported
+  // or if the time budget is checked
+  auto tiles  = make_tiles(state->render.size());
+  auto batch  = (image_cb || params.budget > 0) ? 1 : trace_tile_samples;
+  auto passes = (params.samples + batch - 1) / batch;
+  auto pass_samples = [&](int pass) {
+    return min(batch, params.samples - pass * batch);
+  };
 
-  for (auto sample = 0; sample < params.samples; sample++) {
-    if (progress_cb) progress_cb("trace image", sample, params.samples);
-    if (params.noparallel) {
-      for (auto j = 0; j < state->render.size().y; j++) {
-        for (auto i = 0; i < state->render.size().x; i++) {
-          state->render[{i, j}] = trace_sample(
-              state, scene, camera, {i, j}, params);
-        }
-      }
-    } else {
-      parallel_for(state->render.size(),
-          [state, scene, camera, &params](const vec2i& ij) {
-            state->render[ij] = trace_sample(state, scene, camera, ij, params);
-          });
-    }
-    if (image_cb) image_cb(state->render, sample + 1, params.samples);
-  }
+  // stop when all blocks are converged or when the budget is over
+  auto sampler = get_trace_sampler_func(params);
+  auto traced  = std::atomic<int>{0};
+  if (progress_cb) progress_cb("trace image", 0, params.samples);
+  parallel_tiles(
+      tiles, passes, !params.noparallel,
+      [&](const vec2i& tile, int pass) {
+        traced += trace_tile(state, scene, camera, tile, pass_samples(pass),
+            sampler, params);
+      },
+      [&](int) {
+        update_samples(state);
+        if (!traced) return false;
+        traced = 0;
+        if (image_cb) image_cb(state->render, state->samples, params.samples);
+        if (progress_cb)
+          progress_cb("trace image", state->samples, params.samples);
+        return !is_budget_over(start, params);
+      });
+  if (progress_cb && state->samples < params.samples)
+    progress_cb("trace image", params.samples, params.samples);
 
-  if (progress_cb) progress_cb("trace image", params.samples, params.samples);
+  samples = state->samples;
   return state->render;
 }
 
@@ -2770,19 +3688,39 @@ void trace_start(trc::state* state, const trc::scene* scene,
 
   // start renderer
   state->worker = std::async(std::launch::async, [=]() {
-    for (auto sample = 0; sample < params.samples; sample++) {
-      if (state->stop) return;
-      if (progress_cb) progress_cb("trace img::image", sample, params.samples);
-      parallel_for(state->render.size(), [&](const vec2i& ij) {
-        if (state->stop) return;
-        state->render[ij] = trace_sample(state, scene, camera, ij, params);
-        if (async_cb) async_cb(state->render, sample, params.samples, ij);
-      });
-      if (image_cb) image_cb(state->render, sample + 1, params.samples);
-    }
-    if (progress_cb)
-      progress_cb("trace img::image", params.samples, params.samples);
-    if (image_cb) image_cb(state->render, params.samples, params.samples);
+    auto start   = std::chrono::steady_clock::now();
+    auto tiles   = make_tiles(state->render.size());
+    auto sampler = get_trace_sampler_func(params);
+    auto traced  = std::atomic<int>{0};
+    if (progress_cb) progress_cb("trace img::image", 0, params.samples);
+    parallel_tiles(
+        tiles, params.samples, true,
+        [&](const vec2i& tile, int sample) {
+          if (state->stop) return;
+          traced += trace_tile(state, scene, camera, tile, 1, sampler, params);
+          if (!async_cb) return;
+          auto size = state->render.size();
+          for (auto j = tile.y * trace_tile_size;
+               j < min((tile.y + 1) * trace_tile_size, size.y); j++) {
+            for (auto i = tile.x * trace_tile_size;
+                 i < min((tile.x + 1) * trace_tile_size, size.x); i++) {
+              async_cb(state->render, sample, params.samples, {i, j});
+            }
+          }
+        },
+        [&](int) {
+          if (state->stop) return false;
+          update_samples(state);
+          if (!traced) return false;
+          traced = 0;
+          if (image_cb)
+            image_cb(state->render, state->samples, params.samples);
+          if (progress_cb)
+            progress_cb("trace img::image", state->samples, params.samples);
+          return !is_budget_over(start, params);
+        });
+    if (state->stop) return;
+    if (image_cb) image_cb(state->render, state->samples, params.samples);
   });
 }
 void trace_stop(trc::state* state) {
@@ -2867,29 +3805,39 @@ void set_focus(trc::camera* camera, float aperture, float focus) {
 }
 
 // Add texture
-void set_texture(trc::texture* texture, const img::image<vec3b>& img) {
-  texture->colorb  = img;
+void set_texture(
+    trc::texture* texture, const img::image<vec3b>& img, bool compress) {
+  texture->colorb  = compress ? img::image<vec3b>{} : img;
   texture->colorf  = {};
   texture->scalarb = {};
   texture->scalarf = {};
+  texture->colorc  = compress ? img::compress_image(img) : img::block_image{};
+  texture->scalarc = {};
 }
 void set_texture(trc::texture* texture, const img::image<vec3f>& img) {
   texture->colorb  = {};
   texture->colorf  = img;
   texture->scalarb = {};
   texture->scalarf = {};
+  texture->colorc  = {};
+  texture->scalarc = {};
 }
-void set_texture(trc::texture* texture, const img::image<byte>& img) {
+void set_texture(
+    trc::texture* texture, const img::image<byte>& img, bool compress) {
   texture->colorb  = {};
   texture->colorf  = {};
-  texture->scalarb = img;
+  texture->scalarb = compress ? img::image<byte>{} : img;
   texture->scalarf = {};
+  texture->colorc  = {};
+  texture->scalarc = compress ? img::compress_image(img) : img::block_image{};
 }
 void set_texture(trc::texture* texture, const img::image<float>& img) {
   texture->colorb  = {};
   texture->colorf  = {};
   texture->scalarb = {};
   texture->scalarf = img;
+  texture->colorc  = {};
+  texture->scalarc = {};
 }
 
 // Add shape
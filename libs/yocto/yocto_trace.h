@@ -23,6 +23,13 @@
 // general (you can even more an arbitrary shape sun). For now only the first
 // environment is used.
 //
+// With `adaptive` set in `trace_params`, sampling stops in image regions whose
+// error, estimated from the variance of the samples, falls below the given
+// target. The number of samples is then the maximum per pixel.
+// With `budget` set, rendering stops after the last sample pass that ends
+// within the given number of seconds. Images are deterministic in the number
+// of samples traced, which is reported by the renderer.
+//
 // 1. prepare the ray-tracing acceleration structure with `build_bvh()`
 // 2. prepare lights for rendering with `init_trace_lights()`
 // 3. create the random number generators with `init_trace_state()`
@@ -138,9 +145,13 @@ void set_shape(trc::object* object, trc::shape* shape);
 void set_instance(trc::object* object, trc::instance* instance);
 
 // texture properties
-void set_texture(trc::texture* texture, const img::image<vec3b>& img);
+// LDR images can be stored block compressed, decoding texels on lookup, to
+// save memory in large scenes.
+void set_texture(trc::texture* texture, const img::image<vec3b>& img,
+    bool compress = false);
 void set_texture(trc::texture* texture, const img::image<vec3f>& img);
-void set_texture(trc::texture* texture, const img::image<byte>& img);
+void set_texture(trc::texture* texture, const img::image<byte>& img,
+    bool compress = false);
 void set_texture(trc::texture* texture, const img::image<float>& img);
 
 // material properties
@@ -205,6 +216,8 @@ enum struct bvh_type {
   highquality,
   middle,
   balanced,
+  wide,
+  packed,
 #ifdef YOCTO_EMBREE
   embree_default,
   embree_highquality,
@@ -231,6 +244,8 @@ struct trace_params {
   bool            noparallel = false;
   int             pratio     = 8;
   float           exposure   = 0;
+  float           adaptive   = 0;
+  float           budget     = 0;
 };
 
 const auto sampler_names = std::vector<std::string>{
@@ -241,7 +256,7 @@ const auto falsecolor_names = std::vector<std::string>{"normal", "frontfacing",
     "specular", "coat", "metal", "transmission", "refraction", "roughness",
     "opacity", "object", "element", "highlight"};
 const auto bvh_names        = std::vector<std::string>{
-    "default", "highquality", "middle", "balanced",
+    "default", "highquality", "middle", "balanced", "wide", "packed",
 #ifdef YOCTO_EMBREE
     "embree-default", "embree-highquality", "embree-compact"
 #endif
@@ -268,10 +283,17 @@ void update_bvh(trc::scene*            scene,
     const std::vector<trc::instance*>& updated_instances,
     const trace_params&                params);
 
-// Progressively computes an image.
+// Progressively computes an image. Rendering stops before `params.samples`
+// if the time budget runs out or if adaptive sampling converges everywhere.
+// The overload returns the number of samples traced, the maximum per pixel.
+// Images are not tagged with it, so callers that save renders should record
+// it themselves, e.g. in the file name or alongside the image.
 img::image<vec4f> trace_image(const trc::scene* scene,
     const trc::camera* camera, const trace_params& params,
     progress_callback progress_cb = {}, image_callback image_cb = {});
+img::image<vec4f> trace_image(const trc::scene* scene,
+    const trc::camera* camera, const trace_params& params, int& samples,
+    progress_callback progress_cb = {}, image_callback image_cb = {});
 
 // Check is a sampler requires lights
 bool is_sampler_lit(const trace_params& params);
@@ -307,13 +329,38 @@ struct bvh_node {
   byte   axis;
 };
 
+// Four-wide BVH node, obtained by collapsing the binary tree. Child bounds
+// are stored as structure of arrays to test a ray against all of them at
+// once. Children with `num > 0` are leaves referring to primitives, while
+// children with `num == 0` refer to other wide nodes. Unused children have
+// `start == -1` and empty bounds.
+struct alignas(64) bvh_node4 {
+  float bmin[3][4];
+  float bmax[3][4];
+  int   start[4];
+  short num[4];
+};
+
+// Four triangles stored as structure of arrays, with their first vertex and
+// edges precomputed, to intersect a ray with all of them at once. Leaves of
+// packed bvhs refer to these instead of primitives. Unused lanes have
+// `element == -1` and degenerate edges.
+struct alignas(32) bvh_triangle4 {
+  float v0[3][4];
+  float e1[3][4];
+  float e2[3][4];
+  int   element[4];
+};
+
 // BVH tree stored as a node array with the tree structure is encoded using
 // array indices. BVH nodes indices refer to either the node array,
 // for internal nodes, or the primitive arrays, for leaf nodes.
 // Application data is not stored explicitly.
 struct bvh_tree {
-  std::vector<bvh_node> nodes      = {};
-  std::vector<vec2i>    primitives = {};
+  std::vector<bvh_node>      nodes      = {};
+  std::vector<vec2i>         primitives = {};
+  std::vector<bvh_node4>     wide_nodes = {};  // only for wide and packed
+  std::vector<bvh_triangle4> triangles4 = {};  // only for packed triangles
 };
 
 // Camera based on a simple lens model. The camera is placed using a frame.
@@ -338,12 +385,15 @@ struct camera {
 };
 
 // Texture containing either an LDR or HDR image. HdR images are encoded
-// in linear color space, while LDRs are encoded as sRGB.
+// in linear color space, while LDRs are encoded as sRGB. LDRs may also be
+// block compressed.
 struct texture {
   img::image<vec3f> colorf  = {};
   img::image<vec3b> colorb  = {};
   img::image<float> scalarf = {};
   img::image<byte>  scalarb = {};
+  img::block_image  colorc  = {};
+  img::block_image  scalarc = {};
 };
 
 // Material for surfaces, lines and triangles.
@@ -418,12 +468,22 @@ struct instance {
   std::vector<frame3f> frames = {};
 };
 
+// World transform of an object instance and its inverse. Aligned to a cache
+// line, so that each 96 byte transform spans exactly two lines.
+struct alignas(64) instance_transform {
+  frame3f frame   = identity3x4f;
+  frame3f inverse = identity3x4f;
+};
+
 // Object.
 struct object {
   frame3f        frame    = identity3x4f;
   trc::shape*    shape    = nullptr;
   trc::material* material = nullptr;
   trc::instance* instance = nullptr;
+
+  // computed properties
+  std::vector<instance_transform> transforms = {};
 };
 
 // Environment map.
@@ -471,18 +531,20 @@ struct scene {
 
 // State of a pixel during tracing
 struct pixel {
-  vec3f     radiance = {0, 0, 0};
-  int       hits     = 0;
-  int       samples  = 0;
-  rng_state rng      = {};
+  vec3f     radiance   = {0, 0, 0};
+  float     luminance2 = 0;  // sum of squared luminance, for variance
+  int       hits       = 0;
+  int       samples    = 0;
+  rng_state rng        = {};
 };
 
 // [experimental] Asynchronous state
 struct state {
-  img::image<vec4f> render = {};
-  img::image<pixel> pixels = {};
-  std::future<void> worker = {};  // async
-  std::atomic<bool> stop   = {};  // async
+  img::image<vec4f> render  = {};
+  img::image<pixel> pixels  = {};
+  std::atomic<int>  samples = {};  // samples traced, the maximum per pixel
+  std::future<void> worker  = {};  // async
+  std::atomic<bool> stop    = {};  // async
 };
 
 }  // namespace yocto::trace
@@ -507,11 +569,23 @@ struct intersection3f {
 // Intersect ray with a bvh returning either the first or any intersection
 // depending on `find_any`. Returns the ray distance , the instance id,
 // the shape element index and the element barycentric coordinates.
+// Instance inverses are cached by `init_bvh()` with a full inverse, so
+// `non_rigid_frames` is ignored and kept only for compatibility.
 intersection3f intersect_scene_bvh(const trc::scene* scene, const ray3f& ray,
     bool find_any = false, bool non_rigid_frames = true);
 intersection3f intersect_instance_bvh(const trc::object* object, int instance,
     const ray3f& ray, bool find_any = false, bool non_rigid_frames = true);
 
+// Intersect a stream of rays with a bvh, writing one intersection per ray.
+// Consecutive rays are traced together in packets, so streams of coherent
+// rays, like the camera rays of a tile, are faster to trace than rays one at
+// a time. Rays in packets that are not coherent are traced one at a time.
+// Packets only traverse binary bvhs, so with the wide and packed bvh types
+// all rays are traced one at a time over the wide nodes.
+void intersect_scene_bvh(const trc::scene* scene,
+    const std::vector<ray3f>& rays, std::vector<intersection3f>& intersections,
+    bool find_any = false);
+
 }  // namespace yocto::trace
 
 #endif
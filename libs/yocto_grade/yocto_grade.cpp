@@ -451,12 +451,33 @@ namespace yocto::grade {
     
     
         
-    img::image<vec4f> grade_image(const img::image<vec4f>& img, const grade_params& params) {
+    //applica tutti i filtri tranne la griglia, che viene applicata insieme
+    //alla scrittura del risultato
+    static img::image<vec4f> grade_pixels(const img::image<vec4f>& img, const grade_params& params) {
         
         auto mask_edge = img::image<vec4f>(img.size());
         
-        //applica tonemap
-        auto graded = img::tonemap_image(img, params.exposure, params.filmic, params.srgb);
+        //esposizione automatica dalle statistiche dell'immagine
+        auto exposure = params.exposure;
+        if (params.auto_exposure)
+            exposure += img::compute_auto_exposure(img::compute_image_stats(img));
+        
+        //bloom delle luci che andrebbero oltre il bianco dopo l'esposizione
+        auto bloomed = img::image<vec4f>{};
+        if (params.bloom > 0) {
+            auto bloom = img::bloom_params{};
+            bloom.intensity = params.bloom;
+            bloom.threshold = 1 / exp2(exposure);
+            bloomed = img::bloom_image(img, bloom);
+        }
+        const auto& hdr = params.bloom > 0 ? bloomed : img;
+        
+        //applica tonemap, locale se richiesto
+        auto local = img::local_tonemap_params{};
+        local.contrast = params.local_contrast;
+        auto graded = params.local_tonemap
+            ? img::tonemap_image(hdr, exposure, local, params.filmic, params.srgb)
+            : img::tonemap_image(hdr, exposure, params.filmic, params.srgb);
         //img::tonemap_image_mt(graded, img, params.exposure, params.filmic, params.srgb);
         
         rng_state rng = make_rng(time(nullptr));
@@ -505,27 +526,56 @@ namespace yocto::grade {
         //applica il filtro creato da me
         lowpolify(graded, rng, params);
         
+        return graded;
+    }
+    
+    //applica la griglia a un pixel, usata da entrambe le uscite
+    static vec4f grade_grid(const img::image<vec4f>& graded, const vec2i& ij, const grade_params& params) {
+        
+        //ottieni il "colore" del pixel
+        vec3f color = xyz(graded[ij]);
+        
+        //grid
+        grid(color, ij, params.grid);
+        
+        return xyz_to_xyzw(color, graded[ij].w);
+    }
+    
+    img::image<vec4f> grade_image(const img::image<vec4f>& img, const grade_params& params) {
+        
+        auto graded = grade_pixels(img, params);
+        
         //grid
         for (int y=0; y<graded.size().y; y++)
         {
             for(int x=0; x<graded.size().x; x++)
             {
-                //crea un vettore ij con le coordinate
-                vec2i ij = {x, y};
-                
-                //ottieni il "colore" del pixel
-                vec3f color = xyz(graded[ij]);
-                
-                //grid
-                grid(color, ij, params.grid);
-                
                 //aggiorna il pixel di nuovo
-                graded[ij] = xyz_to_xyzw(color, graded[ij].w);
-                
+                graded[{x, y}] = grade_grid(graded, {x, y}, params);
             }
         }
         
         return graded;
     }
+    
+    img::image<vec4b> grade_imageb(const img::image<vec4f>& img, const grade_params& params) {
+        
+        auto graded = grade_pixels(img, params);
+        
+        //scrivi direttamente i byte, senza una seconda immagine float
+        auto result = img::image<vec4b>(graded.size(), img::uninit);
+        
+        //grid
+        for (int y=0; y<graded.size().y; y++)
+        {
+            for(int x=0; x<graded.size().x; x++)
+            {
+                //converti il pixel in byte
+                result[{x, y}] = float_to_byte(grade_grid(graded, {x, y}, params));
+            }
+        }
+        
+        return result;
+    }
 
 }  // namespace yocto::grade
@@ -48,7 +48,11 @@ namespace img = yocto::image;
 // Color grading parameters
 struct grade_params {
   float exposure        = 0.0f;
+  bool  auto_exposure   = false;  // adds the exposure computed from stats
   bool  filmic          = false;
+  bool  local_tonemap   = false;  // compresses hdr range before tonemap
+  float local_contrast  = 5.0f;   // range in stops of local tonemap
+  float bloom           = 0.0f;   // glow around the highlights
   bool  srgb            = true;
   vec3f tint            = vec3f{1, 1, 1};
   float saturation      = 0.5f;
@@ -68,6 +72,10 @@ struct grade_params {
 img::image<vec4f> grade_image(
     const img::image<vec4f>& img, const grade_params& params);
 
+// Grades an image directly to 8-bit sRGB, ready to be saved.
+img::image<vec4b> grade_imageb(
+    const img::image<vec4f>& img, const grade_params& params);
+
 };  // namespace yocto::grade
 
 #endif
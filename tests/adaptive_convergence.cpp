@@ -0,0 +1,98 @@
+//
+// Compares uniform and adaptive sampling by time to quality on the Cornell
+// box. Renders a high sample count reference, then prints the render time and
+// the rmse against the reference for a few uniform sample counts and adaptive
+// error targets. Renders are serial for stable timings. Pass a resolution to
+// override the default of 64.
+//
+// Not run by ctest, since the reference alone takes several seconds.
+//
+
+#include <yocto/yocto_sceneio.h>
+#include <yocto/yocto_trace.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <utility>
+
+using namespace yocto::math;
+namespace img = yocto::image;
+namespace scn = yocto::sceneio;
+namespace trc = yocto::trace;
+
+// Converts the shapes, materials and first camera of a model made only of
+// triangle meshes with colors and emission, like the Cornell box.
+static trc::camera* add_model(trc::scene* scene, const scn::model* model) {
+  for (auto mobject : model->objects) {
+    auto shape = trc::add_shape(scene);
+    trc::set_positions(shape, mobject->shape->positions);
+    trc::set_triangles(shape, mobject->shape->triangles);
+    auto material = trc::add_material(scene);
+    trc::set_color(material, mobject->material->color);
+    trc::set_emission(material, mobject->material->emission);
+    auto object = trc::add_object(scene);
+    trc::set_frame(object, mobject->frame);
+    trc::set_shape(object, shape);
+    trc::set_material(object, material);
+  }
+  auto mcamera = model->cameras.front();
+  auto camera  = trc::add_camera(scene);
+  trc::set_frame(camera, mcamera->frame);
+  trc::set_lens(camera, mcamera->lens, mcamera->aspect, mcamera->film);
+  trc::set_focus(camera, mcamera->aperture, mcamera->focus);
+  return camera;
+}
+
+// Root mean square error of a render against a reference.
+static double rmse(const img::image<vec4f>& render,
+    const img::image<vec4f>& reference) {
+  auto error = 0.0;
+  for (auto idx = (size_t)0; idx < render.count(); idx++) {
+    auto diff = xyz(render[idx]) - xyz(reference[idx]);
+    error += dot(diff, diff) / 3;
+  }
+  return std::sqrt(error / render.count());
+}
+
+int main(int argc, const char* argv[]) {
+  auto model_guard = std::make_unique<scn::model>();
+  scn::make_cornellbox(model_guard.get());
+  auto scene_guard = std::make_unique<trc::scene>();
+  auto scene       = scene_guard.get();
+  auto camera      = add_model(scene, model_guard.get());
+
+  auto params       = trc::trace_params{};
+  params.resolution = argc > 1 ? atoi(argv[1]) : 64;
+  params.noparallel = true;
+  trc::init_bvh(scene, params);
+  trc::init_lights(scene);
+
+  // reference, with a different seed than the renders
+  params.samples = 1024;
+  params.seed    = 99;
+  auto reference = trc::trace_image(scene, camera, params);
+  params.seed    = trc::default_seed;
+
+  // renders at increasing quality
+  auto render = [&](int samples, float adaptive) {
+    params.samples  = samples;
+    params.adaptive = adaptive;
+    auto start      = std::chrono::high_resolution_clock::now();
+    auto image      = trc::trace_image(scene, camera, params);
+    auto end        = std::chrono::high_resolution_clock::now();
+    auto time       = std::chrono::duration<double>(end - start).count();
+    return std::pair{time, rmse(image, reference)};
+  };
+  for (auto samples : {64, 128, 256}) {
+    auto [time, error] = render(samples, 0);
+    printf("uniform  %4d spp: %6.2f s, rmse %.4f\n", samples, time, error);
+  }
+  for (auto adaptive : {0.08f, 0.06f, 0.04f}) {
+    auto [time, error] = render(512, adaptive);
+    printf("adaptive %.2f:    %6.2f s, rmse %.4f\n", adaptive, time, error);
+  }
+  return 0;
+}
@@ -0,0 +1,93 @@
+//
+// Measures the single-threaded ray throughput of a large triangle mesh over
+// the binary, wide and packed bvhs, to compare wide leaves with triangles
+// packed four at a time. Fails if the bvhs find different hits.
+//
+
+#include <yocto/yocto_trace.h>
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+using namespace yocto::math;
+namespace trc = yocto::trace;
+
+// Adds a sphere tessellated in `steps` x `steps` quads and displaced by noise.
+static trc::shape* add_bumpy_sphere(trc::scene* scene, int steps) {
+  auto positions = std::vector<vec3f>{};
+  auto triangles = std::vector<vec3i>{};
+  for (auto j = 0; j <= steps; j++) {
+    for (auto i = 0; i <= steps; i++) {
+      auto u = 2 * pif * i / steps, v = pif * j / steps;
+      auto p = vec3f{cos(u) * sin(v), cos(v), sin(u) * sin(v)};
+      positions.push_back(p * (1 + 0.2f * perlin_fbm(p * 4)));
+    }
+  }
+  for (auto j = 0; j < steps; j++) {
+    for (auto i = 0; i < steps; i++) {
+      auto v = j * (steps + 1) + i;
+      triangles.push_back({v, v + 1, v + steps + 2});
+      triangles.push_back({v, v + steps + 2, v + steps + 1});
+    }
+  }
+  auto shape = trc::add_shape(scene);
+  trc::set_positions(shape, positions);
+  trc::set_triangles(shape, triangles);
+  return shape;
+}
+
+int main() {
+  auto scene_guard = std::make_unique<trc::scene>();
+  auto scene       = scene_guard.get();
+  auto object      = trc::add_object(scene);
+  trc::set_shape(object, add_bumpy_sphere(scene, 400));
+  trc::set_material(object, trc::add_material(scene));
+
+  // rays from around the sphere towards random points within it
+  auto rng  = make_rng(7);
+  auto rays = std::vector<ray3f>(1 << 18);
+  for (auto& ray : rays) {
+    auto origin = sample_sphere(rand2f(rng)) * 3;
+    auto target = (rand3f(rng) - 0.5f) * 2;
+    ray         = {origin, normalize(target - origin)};
+  }
+
+  auto reference = std::vector<trc::intersection3f>{};
+  auto names     = std::vector<const char*>{"binary", "wide", "packed"};
+  auto types     = std::vector<trc::bvh_type>{
+      trc::bvh_type::default_, trc::bvh_type::wide, trc::bvh_type::packed};
+  for (auto type = 0; type < (int)types.size(); type++) {
+    auto params       = trc::trace_params{};
+    params.bvh        = types[type];
+    params.noparallel = true;
+    trc::init_bvh(scene, params);
+
+    auto intersections = std::vector<trc::intersection3f>(rays.size());
+    auto best          = 1e30;
+    for (auto run = 0; run < 3; run++) {
+      auto start = std::chrono::high_resolution_clock::now();
+      for (auto idx = (size_t)0; idx < rays.size(); idx++) {
+        intersections[idx] = trc::intersect_scene_bvh(scene, rays[idx]);
+      }
+      auto end = std::chrono::high_resolution_clock::now();
+      best = std::min(best, std::chrono::duration<double>(end - start).count());
+    }
+    printf("%-6s bvh: %.2f Mrays/s\n", names[type], rays.size() / best / 1e6);
+
+    if (reference.empty()) {
+      reference = intersections;
+      continue;
+    }
+    for (auto idx = (size_t)0; idx < rays.size(); idx++) {
+      auto &a = reference[idx], &b = intersections[idx];
+      if (a.hit != b.hit || a.element != b.element ||
+          a.distance != b.distance) {
+        printf("%s bvh hits differ at ray %d\n", names[type], (int)idx);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,96 @@
+//
+// Measures the single-threaded ray throughput of a scene with many instances
+// of a small mesh, which stresses the instance transforms read during
+// traversal. Fails if the scene bvh finds different hits than intersecting
+// every instance on its own.
+//
+
+#include <yocto/yocto_trace.h>
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+using namespace yocto::math;
+namespace trc = yocto::trace;
+
+// Adds a box shape.
+static trc::shape* add_box(trc::scene* scene, const vec3f& min,
+    const vec3f& max) {
+  auto shape = trc::add_shape(scene);
+  trc::set_positions(shape, {{min.x, min.y, max.z}, {max.x, min.y, max.z},
+                                {max.x, max.y, max.z}, {min.x, max.y, max.z},
+                                {min.x, min.y, min.z}, {max.x, min.y, min.z},
+                                {max.x, max.y, min.z}, {min.x, max.y, min.z}});
+  trc::set_triangles(shape, {{0, 1, 2}, {2, 3, 0}, {5, 4, 7}, {7, 6, 5},
+                                {1, 5, 6}, {6, 2, 1}, {4, 0, 3}, {3, 7, 4},
+                                {3, 2, 6}, {6, 7, 3}, {4, 5, 1}, {1, 0, 4}});
+  return shape;
+}
+
+int main() {
+  // randomly rotated and scaled boxes in a cube
+  auto scene_guard = std::make_unique<trc::scene>();
+  auto scene       = scene_guard.get();
+  auto rng         = make_rng(7);
+  auto frames      = std::vector<frame3f>(32768);
+  for (auto& frame : frames) {
+    auto axis = normalize(rand3f(rng) - 0.5f);
+    frame     = translation_frame((rand3f(rng) - 0.5f) * 64) *
+            rotation_frame(axis, rand1f(rng) * 2 * pif) *
+            scaling_frame(vec3f{0.5f + rand1f(rng)});
+  }
+  auto instance = trc::add_instance(scene);
+  trc::set_frames(instance, frames);
+  auto shape  = add_box(scene, {-0.5f, -0.5f, -0.5f}, {0.5f, 0.5f, 0.5f});
+  auto object = trc::add_object(scene);
+  trc::set_shape(object, shape);
+  trc::set_instance(object, instance);
+  trc::set_material(object, trc::add_material(scene));
+
+  auto params       = trc::trace_params{};
+  params.noparallel = true;
+  trc::init_bvh(scene, params);
+
+  // random rays from within the cube
+  auto rays = std::vector<ray3f>(1 << 18);
+  for (auto& ray : rays) {
+    ray = {(rand3f(rng) - 0.5f) * 64, sample_sphere(rand2f(rng))};
+  }
+
+  auto best = 1e30;
+  auto hits = 0;
+  for (auto run = 0; run < 3; run++) {
+    hits       = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto& ray : rays) {
+      if (trc::intersect_scene_bvh(scene, ray).hit) hits++;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    best = std::min(best, std::chrono::duration<double>(end - start).count());
+  }
+  printf("%d instances: %.2f Mrays/s, %d of %d rays hit\n", (int)frames.size(),
+      rays.size() / best / 1e6, hits, (int)rays.size());
+
+  // check a few rays against every instance
+  for (auto idx = 0; idx < 256; idx++) {
+    auto& ray          = rays[idx];
+    auto  intersection = trc::intersect_scene_bvh(scene, ray);
+    auto  closest      = trc::intersection3f{};
+    for (auto instance = 0; instance < (int)frames.size(); instance++) {
+      auto candidate = trc::intersect_instance_bvh(object, instance, ray);
+      if (!candidate.hit) continue;
+      if (closest.hit && closest.distance <= candidate.distance) continue;
+      closest          = candidate;
+      closest.instance = instance;
+    }
+    if (intersection.hit != closest.hit ||
+        (closest.hit && (intersection.instance != closest.instance ||
+                            intersection.distance != closest.distance))) {
+      printf("ray %d hits differ from the per-instance query\n", idx);
+      return 1;
+    }
+  }
+  return 0;
+}
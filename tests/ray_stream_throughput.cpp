@@ -0,0 +1,119 @@
+//
+// Measures the single-threaded throughput of coherent camera rays traced one
+// at a time and as a ray stream, over a grid of instanced spheres. Rays are
+// ordered in 4x4 pixel blocks, as in trace_image(). Fails if the stream query
+// finds different hits than the per-ray one.
+//
+
+#include <yocto/yocto_trace.h>
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+using namespace yocto::math;
+namespace trc = yocto::trace;
+
+// Adds a sphere tessellated in `steps` x `steps` quads.
+static trc::shape* add_sphere(trc::scene* scene, int steps) {
+  auto positions = std::vector<vec3f>{};
+  auto triangles = std::vector<vec3i>{};
+  for (auto j = 0; j <= steps; j++) {
+    for (auto i = 0; i <= steps; i++) {
+      auto u = 2 * pif * i / steps, v = pif * j / steps;
+      positions.push_back({cos(u) * sin(v), cos(v), sin(u) * sin(v)});
+    }
+  }
+  for (auto j = 0; j < steps; j++) {
+    for (auto i = 0; i < steps; i++) {
+      auto v = j * (steps + 1) + i;
+      triangles.push_back({v, v + 1, v + steps + 2});
+      triangles.push_back({v, v + steps + 2, v + steps + 1});
+    }
+  }
+  auto shape = trc::add_shape(scene);
+  trc::set_positions(shape, positions);
+  trc::set_triangles(shape, triangles);
+  return shape;
+}
+
+// Runs `func` three times and returns the best time in seconds.
+template <typename Func>
+static double time_best(Func&& func) {
+  auto best = 1e30;
+  for (auto run = 0; run < 3; run++) {
+    auto start = std::chrono::high_resolution_clock::now();
+    func();
+    auto end = std::chrono::high_resolution_clock::now();
+    best = std::min(best, std::chrono::duration<double>(end - start).count());
+  }
+  return best;
+}
+
+int main() {
+  // 4x4x4 randomly rotated and scaled spheres
+  auto scene_guard = std::make_unique<trc::scene>();
+  auto scene       = scene_guard.get();
+  auto rng         = make_rng(7);
+  auto frames      = std::vector<frame3f>{};
+  for (auto k = 0; k < 4; k++) {
+    for (auto j = 0; j < 4; j++) {
+      for (auto i = 0; i < 4; i++) {
+        auto axis = normalize(rand3f(rng) - 0.5f);
+        frames.push_back(translation_frame({i * 3.0f, j * 3.0f, k * 3.0f}) *
+                         rotation_frame(axis, rand1f(rng) * 3) *
+                         scaling_frame(vec3f{0.5f + rand1f(rng)}));
+      }
+    }
+  }
+  auto instance = trc::add_instance(scene);
+  trc::set_frames(instance, frames);
+  auto object = trc::add_object(scene);
+  trc::set_shape(object, add_sphere(scene, 100));
+  trc::set_instance(object, instance);
+  trc::set_material(object, trc::add_material(scene));
+
+  auto params       = trc::trace_params{};
+  params.noparallel = true;
+  trc::init_bvh(scene, params);
+
+  // pinhole camera rays, ordered in 4x4 pixel blocks
+  auto eye        = vec3f{6, 6, -16};
+  auto resolution = 512;
+  auto rays       = std::vector<ray3f>{};
+  for (auto bj = 0; bj < resolution; bj += 4) {
+    for (auto bi = 0; bi < resolution; bi += 4) {
+      for (auto lane = 0; lane < 16; lane++) {
+        auto i = bi + lane % 4, j = bj + lane / 4;
+        auto d = vec3f{(i + 0.5f) / resolution - 0.5f,
+            (j + 0.5f) / resolution - 0.5f, 1};
+        rays.push_back({eye, normalize(d)});
+      }
+    }
+  }
+
+  auto single = std::vector<trc::intersection3f>(rays.size());
+  auto stream = std::vector<trc::intersection3f>{};
+  auto single_time = time_best([&]() {
+    for (auto idx = (size_t)0; idx < rays.size(); idx++) {
+      single[idx] = trc::intersect_scene_bvh(scene, rays[idx]);
+    }
+  });
+  auto stream_time = time_best(
+      [&]() { trc::intersect_scene_bvh(scene, rays, stream); });
+  auto mrays = rays.size() / 1e6;
+  printf("per-ray: %.2f Mrays/s\n", mrays / single_time);
+  printf("stream:  %.2f Mrays/s (%.2fx)\n", mrays / stream_time,
+      single_time / stream_time);
+
+  for (auto idx = (size_t)0; idx < rays.size(); idx++) {
+    auto &a = single[idx], &b = stream[idx];
+    if (a.hit != b.hit || a.instance != b.instance || a.element != b.element ||
+        a.distance != b.distance) {
+      printf("stream hits differ at ray %d\n", (int)idx);
+      return 1;
+    }
+  }
+  return 0;
+}
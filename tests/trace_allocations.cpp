@@ -0,0 +1,95 @@
+//
+// Checks that the path tracing loop does not allocate memory, by counting
+// allocations while rendering a scene with a volume at different sample
+// counts. The count may depend on the scene and image size, but not on the
+// number of samples.
+//
+
+#include <yocto/yocto_trace.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+// count allocations
+static std::atomic<long> allocations = {0};
+
+void* operator new(size_t size) {
+  allocations++;
+  if (auto ptr = malloc(size)) return ptr;
+  throw std::bad_alloc{};
+}
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+
+using namespace yocto::math;
+namespace trc = yocto::trace;
+
+// Adds a box with the given material.
+static trc::object* add_box(trc::scene* scene, const vec3f& min,
+    const vec3f& max, trc::material* material) {
+  auto shape = trc::add_shape(scene);
+  trc::set_positions(shape, {{min.x, min.y, max.z}, {max.x, min.y, max.z},
+                                {max.x, max.y, max.z}, {min.x, max.y, max.z},
+                                {min.x, min.y, min.z}, {max.x, min.y, min.z},
+                                {max.x, max.y, min.z}, {min.x, max.y, min.z}});
+  trc::set_triangles(shape, {{0, 1, 2}, {2, 3, 0}, {5, 4, 7}, {7, 6, 5},
+                                {1, 5, 6}, {6, 2, 1}, {4, 0, 3}, {3, 7, 4},
+                                {3, 2, 6}, {6, 7, 3}, {4, 5, 1}, {1, 0, 4}});
+  auto object = trc::add_object(scene);
+  trc::set_shape(object, shape);
+  trc::set_material(object, material);
+  return object;
+}
+
+int main() {
+  // scene with a floor, a scattering volume and an area light
+  auto scene_guard = std::make_unique<trc::scene>();
+  auto scene       = scene_guard.get();
+  auto camera      = trc::add_camera(scene);
+  trc::set_frame(camera, lookat_frame({0, 1, 3}, {0, 0.5f, 0}, {0, 1, 0}));
+  trc::set_lens(camera, 0.036f, 1, 0.036f);
+  auto floor = trc::add_material(scene);
+  trc::set_color(floor, {0.7f, 0.7f, 0.7f});
+  add_box(scene, {-2, -0.1f, -2}, {2, 0, 2}, floor);
+  auto volume = trc::add_material(scene);
+  trc::set_specular(volume, 1);
+  trc::set_roughness(volume, 0);
+  trc::set_transmission(volume, 1, false, 0.5f);
+  trc::set_scattering(volume, {0.5f, 0.5f, 0.5f}, 0);
+  add_box(scene, {-0.5f, 0.1f, -0.5f}, {0.5f, 1.1f, 0.5f}, volume);
+  auto light = trc::add_material(scene);
+  trc::set_emission(light, {10, 10, 10});
+  add_box(scene, {-0.5f, 2, -0.5f}, {0.5f, 2.1f, 0.5f}, light);
+
+  auto params       = trc::trace_params{};
+  params.resolution = 64;
+  params.noparallel = true;
+  trc::init_bvh(scene, params);
+  trc::init_lights(scene);
+
+  // render once, so that one-time initializations are not counted
+  trc::trace_image(scene, camera, params);
+
+  // the allocations of a render must not depend on its samples
+  auto failed = false;
+  for (auto sampler : {trc::sampler_type::path, trc::sampler_type::naive}) {
+    auto counts = std::vector<long>{};
+    for (auto samples : {1, 16, 64}) {
+      params.sampler = sampler;
+      params.samples = samples;
+      auto start     = allocations.load();
+      auto image     = trc::trace_image(scene, camera, params);
+      counts.push_back(allocations.load() - start);
+    }
+    printf("sampler %d: %ld %ld %ld allocations for 1, 16, 64 samples\n",
+        (int)sampler, counts[0], counts[1], counts[2]);
+    if (counts[0] != counts[1] || counts[0] != counts[2]) failed = true;
+  }
+
+  if (failed) printf("allocations depend on the number of samples\n");
+  return failed ? 1 : 0;
+}